@@ -0,0 +1,513 @@
+#include <iostream>
+#include <fstream>
+#include <cstddef>
+#include <cstdint>
+
+// Define constants
+
+// given key in the kattis assignment is 16 bytes long, AES-128 is the default everywhere
+static const int KEY_SIZE = 16;
+// AES-256 keys are the longest
+static const int MAX_KEY_SIZE = 32;
+// plaintext is at most 10e6 according to kattis
+static const int PLAINTEXT_SIZE = 16 * 1000000;
+
+// According to the specification: https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.197.pdf
+// Number  of  columns  (32-bit  words)  comprising  the  State.  For  this  standard, Nb = 4.
+static const int Nb = 4;
+// Number  of  32-bit  words  comprising  the  Cipher  Key.  Nk = 4, 6 or 8 for AES-128, AES-192 and AES-256
+static const int Nk = 4;
+// Number  of  rounds,  which  is  a  function  of  Nk and  Nb (which  is  fixed). Nr = 10, 12 or 14
+static const int Nr = 10;
+// The key schedule and the ciphers are templates on Nk and Nr (defaulting to the AES-128 values
+// above), so every key size gets its own round loop with a constant round count
+static const int MAX_Nr = 14;
+
+// Compile-time lookup tables (S_box, Rcon, T-tables, ...)
+#include "aes_tables.hpp"
+
+// An expanded key is 4 * Nb * (Nr + 1) bytes, the round keys one after the other. The first Nk
+// words are the original key.
+// Every function takes the expanded key it uses as an argument, there is no global cipher state,
+// so any number of threads can encrypt with different keys at the same time.
+
+/**
+ * Prints the given word
+ * */
+void print_word(uint8_t const *const &word)
+{
+    std::cout << std::hex << static_cast<int>(word[0]) << " " << static_cast<int>(word[1]) << " " << static_cast<int>(word[2]) << " " << static_cast<int>(word[3]) << std::endl;
+}
+
+/**
+ * Prints the given block
+ * */
+void print_block(uint8_t const *const &block)
+{
+    for (int i = 0; i < Nb; i++)
+    {
+        uint8_t *temp_word = new uint8_t[4]{block[i * 4], block[i * 4 + 1], block[i * 4 + 2], block[i * 4 + 3]};
+        print_word(temp_word);
+        delete[] temp_word;
+    }
+}
+
+/**
+ * Rotates a word left one step
+ * */
+uint8_t *const &RotWord(uint8_t *const &temp)
+{
+    uint8_t t = temp[0];
+    temp[0] = temp[1];
+    temp[1] = temp[2];
+    temp[2] = temp[3];
+    temp[3] = t;
+    return temp;
+}
+
+/**
+ * Substitutes each value in a word with the corresponding value in the S_box
+ * */
+uint8_t *const &SubWord(uint8_t *const &temp)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint8_t substituted_val = S_box[temp[i]];
+        temp[i] = substituted_val;
+    }
+    return temp;
+}
+
+/**
+ * Performs Key Expansion of cipher_key (4 * Nk bytes) and fills out schedule with keys for all rounds
+ * */
+template <int Nk = ::Nk, int Nr = Nk + 6>
+void ExpandKey(uint8_t const *cipher_key, uint8_t *schedule)
+{
+    static_assert((Nk == 4 || Nk == 6 || Nk == 8) && Nr == Nk + 6, "AES-128, AES-192 or AES-256");
+    uint8_t temp_word[4];
+
+    int i = 0;
+
+    // first key is the original key
+    // i is the i:th word
+    while (i < Nk)
+    {
+        schedule[(i * 4)] = cipher_key[i * 4];
+        schedule[(i * 4) + 1] = cipher_key[(i * 4) + 1];
+        schedule[(i * 4) + 2] = cipher_key[(i * 4) + 2];
+        schedule[(i * 4) + 3] = cipher_key[(i * 4) + 3];
+        i++;
+    }
+
+    // Perform the expansion for the remaining words of the Nr + 1 round keys
+    i = Nk;
+    while (i < (Nb * (Nr + 1)))
+    {
+        temp_word[0] = schedule[4 * (i - 1)];
+        temp_word[1] = schedule[(4 * (i - 1)) + 1];
+        temp_word[2] = schedule[(4 * (i - 1)) + 2];
+        temp_word[3] = schedule[(4 * (i - 1)) + 3];
+        if (i % Nk == 0)
+        {
+            // Rotate and substitute the word
+            SubWord(RotWord(temp_word));
+            // xor the word, since only the first element in the round constant is non-zero,
+            // it's enough to xor the first element of temp_word with the the corresponding element in Rcon
+            uint8_t t = temp_word[0];
+            temp_word[0] = t ^ Rcon[(i / Nk) - 1];
+        }
+        else if (Nk > 6 && i % Nk == 4)
+        {
+            // AES-256 substitutes the middle word as well
+            SubWord(temp_word);
+        }
+        schedule[4 * i] = schedule[(i - Nk) * 4] ^ temp_word[0];
+        schedule[(4 * i) + 1] = schedule[((i - Nk) * 4) + 1] ^ temp_word[1];
+        schedule[(4 * i) + 2] = schedule[((i - Nk) * 4) + 2] ^ temp_word[2];
+        schedule[(4 * i) + 3] = schedule[((i - Nk) * 4) + 3] ^ temp_word[3];
+
+        // go to the next word 
+        i++;
+    }
+}
+
+// ------- The state -------
+// The state is kept in the byte order of the input block, which is column-major: byte 4 * c + r is
+// row r of column c (section 3.4 of FIPS-197). An expanded key has the same layout, so a round
+// key is added with a straight 16 byte xor and nothing is ever transposed.
+
+/**
+ * xor's the given state with round key number round_key of the expanded key round_keys
+ * */
+void AddRoundKey(uint8_t *const &state, uint8_t const *round_keys, int round_key)
+{
+    uint8_t const *round_key_bytes = round_keys + round_key * 4 * Nb;
+    for (int i = 0; i < 4 * Nb; i++)
+    {
+        state[i] = state[i] ^ round_key_bytes[i];
+    }
+}
+
+/**
+ * Substitutes each value in the given state with its corresponding value in the substitutaion box
+ * */
+void SubBytes(uint8_t *const &state)
+{
+    for (int i = 0; i < 4 * Nb; i++)
+    {
+        state[i] = S_box[state[i]];
+    }
+}
+
+/**
+ * Shifts each row 0, 1, 2 or 3 positions to the left.
+ *  - row 0, shifts 0 positions to left
+ *  - row 1, shifts 1 positions to left
+ *  - row 2, shifts 2 positions to left
+ *  - row 3, shifts 3 positions to left
+ * so row r of column c is taken from column c + r
+ * */
+void ShiftRows(uint8_t *const &state)
+{
+    for (int r = 1; r < 4; r++)
+    {
+        uint8_t row[Nb];
+        for (int c = 0; c < Nb; c++)
+        {
+            row[c] = state[4 * ((c + r) % Nb) + r];
+        }
+        for (int c = 0; c < Nb; c++)
+        {
+            state[4 * c + r] = row[c];
+        }
+    }
+}
+
+// ------- MixColumns and InvMixColumns on one column -------
+// Four ways of computing the same thing. Row k of the column is column[k], or byte k (bits 8k to 8k + 7)
+// of the word for the SWAR versions. multiply_in_GF is the reference, the others avoid its 8 step loop:
+//  - _Table looks the products up in the Mul_xx tables, 256 bytes per coefficient
+//  - _XTime only multiplies by 02, using 03 * x = 02 * x ^ x and the shared sum of the column
+//  - _SWAR does the same xtime on all four bytes of a 32-bit word at once
+// The inverse versions use the factorization of the InvMixColumns matrix into the MixColumns
+// matrix times (05 00 04 00 / 00 05 00 04 / 04 00 05 00 / 00 04 00 05), so they cost two more xtime's.
+
+/**
+ * Mix one column by performing multiplication in Galois field GF(2^8) with the following matrix
+ *
+ * 02 03 01 01
+ * 01 02 03 01
+ * 01 01 02 03
+ * 03 01 01 02
+ *
+ * */
+static inline void MixColumn_GF(uint8_t *column)
+{
+    uint8_t a0 = column[0], a1 = column[1], a2 = column[2], a3 = column[3];
+    column[0] = multiply_in_GF(a0, 0x02) ^ multiply_in_GF(a1, 0x03) ^ a2 ^ a3;
+    column[1] = a0 ^ multiply_in_GF(a1, 0x02) ^ multiply_in_GF(a2, 0x03) ^ a3;
+    column[2] = a0 ^ a1 ^ multiply_in_GF(a2, 0x02) ^ multiply_in_GF(a3, 0x03);
+    column[3] = multiply_in_GF(a0, 0x03) ^ a1 ^ a2 ^ multiply_in_GF(a3, 0x02);
+}
+
+static inline void MixColumn_Table(uint8_t *column)
+{
+    uint8_t a0 = column[0], a1 = column[1], a2 = column[2], a3 = column[3];
+    column[0] = Mul_02[a0] ^ Mul_03[a1] ^ a2 ^ a3;
+    column[1] = a0 ^ Mul_02[a1] ^ Mul_03[a2] ^ a3;
+    column[2] = a0 ^ a1 ^ Mul_02[a2] ^ Mul_03[a3];
+    column[3] = Mul_03[a0] ^ a1 ^ a2 ^ Mul_02[a3];
+}
+
+static void MixColumn_XTime(uint8_t *column)
+{
+    uint8_t a0 = column[0], a1 = column[1], a2 = column[2], a3 = column[3];
+    // 02 * a0 ^ 03 * a1 ^ a2 ^ a3 = a0 ^ (a0 ^ a1 ^ a2 ^ a3) ^ 02 * (a0 ^ a1)
+    uint8_t sum = a0 ^ a1 ^ a2 ^ a3;
+    column[0] = a0 ^ sum ^ xtime(a0 ^ a1);
+    column[1] = a1 ^ sum ^ xtime(a1 ^ a2);
+    column[2] = a2 ^ sum ^ xtime(a2 ^ a3);
+    column[3] = a3 ^ sum ^ xtime(a3 ^ a0);
+}
+
+/**
+ * xtime on each of the four bytes of a word
+ * */
+static inline uint32_t xtime_SWAR(uint32_t word)
+{
+    return ((word & 0x7f7f7f7f) << 1) ^ (((word >> 7) & 0x01010101) * 0x1b);
+}
+
+/**
+ * Moves row k + n of the column to row k
+ * */
+static inline uint32_t rotate_rows(uint32_t column, int n)
+{
+    return (column >> (8 * n)) | (column << (32 - 8 * n));
+}
+
+static uint32_t MixColumn_SWAR(uint32_t column)
+{
+    // row k is 02 * (a_k ^ a_k+1) ^ a_k+1 ^ a_k+2 ^ a_k+3
+    uint32_t pairs = column ^ rotate_rows(column, 1);
+    return xtime_SWAR(pairs) ^ rotate_rows(column, 1) ^ rotate_rows(pairs, 2);
+}
+
+/**
+ * Inverse of MixColumn, with the following matrix
+ *
+ * 0e 0b 0d 09
+ * 09 0e 0b 0d
+ * 0d 09 0e 0b
+ * 0b 0d 09 0e
+ *
+ * */
+static inline void InvMixColumn_GF(uint8_t *column)
+{
+    uint8_t a0 = column[0], a1 = column[1], a2 = column[2], a3 = column[3];
+    column[0] = multiply_in_GF(a0, 0x0e) ^ multiply_in_GF(a1, 0x0b) ^ multiply_in_GF(a2, 0x0d) ^ multiply_in_GF(a3, 0x09);
+    column[1] = multiply_in_GF(a0, 0x09) ^ multiply_in_GF(a1, 0x0e) ^ multiply_in_GF(a2, 0x0b) ^ multiply_in_GF(a3, 0x0d);
+    column[2] = multiply_in_GF(a0, 0x0d) ^ multiply_in_GF(a1, 0x09) ^ multiply_in_GF(a2, 0x0e) ^ multiply_in_GF(a3, 0x0b);
+    column[3] = multiply_in_GF(a0, 0x0b) ^ multiply_in_GF(a1, 0x0d) ^ multiply_in_GF(a2, 0x09) ^ multiply_in_GF(a3, 0x0e);
+}
+
+static inline void InvMixColumn_Table(uint8_t *column)
+{
+    uint8_t a0 = column[0], a1 = column[1], a2 = column[2], a3 = column[3];
+    column[0] = Mul_0e[a0] ^ Mul_0b[a1] ^ Mul_0d[a2] ^ Mul_09[a3];
+    column[1] = Mul_09[a0] ^ Mul_0e[a1] ^ Mul_0b[a2] ^ Mul_0d[a3];
+    column[2] = Mul_0d[a0] ^ Mul_09[a1] ^ Mul_0e[a2] ^ Mul_0b[a3];
+    column[3] = Mul_0b[a0] ^ Mul_0d[a1] ^ Mul_09[a2] ^ Mul_0e[a3];
+}
+
+static inline void InvMixColumn_XTime(uint8_t *column)
+{
+    uint8_t even = xtime(xtime(column[0] ^ column[2]));
+    uint8_t odd = xtime(xtime(column[1] ^ column[3]));
+    column[0] ^= even;
+    column[1] ^= odd;
+    column[2] ^= even;
+    column[3] ^= odd;
+    MixColumn_XTime(column);
+}
+
+static uint32_t InvMixColumn_SWAR(uint32_t column)
+{
+    column ^= xtime_SWAR(xtime_SWAR(column ^ rotate_rows(column, 2)));
+    return MixColumn_SWAR(column);
+}
+
+/**
+ * Mix the columns in the state, see MixColumn_GF. Uses the SWAR version, the fastest in `make bench`
+ * */
+void MixColumns(uint8_t *const &state)
+{
+    for (int i = 0; i < Nb; i++)
+    {
+        uint8_t *bytes = state + 4 * i;
+        uint32_t column = static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+                          (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+        column = MixColumn_SWAR(column);
+
+        bytes[0] = static_cast<uint8_t>(column);
+        bytes[1] = static_cast<uint8_t>(column >> 8);
+        bytes[2] = static_cast<uint8_t>(column >> 16);
+        bytes[3] = static_cast<uint8_t>(column >> 24);
+    }
+}
+
+/**
+ * Inverse of MixColumns, see InvMixColumn_GF
+ * */
+static void InvMixColumns(uint8_t *const &state)
+{
+    for (int i = 0; i < Nb; i++)
+    {
+        uint8_t *bytes = state + 4 * i;
+        uint32_t column = static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+                          (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+        column = InvMixColumn_SWAR(column);
+
+        bytes[0] = static_cast<uint8_t>(column);
+        bytes[1] = static_cast<uint8_t>(column >> 8);
+        bytes[2] = static_cast<uint8_t>(column >> 16);
+        bytes[3] = static_cast<uint8_t>(column >> 24);
+    }
+}
+
+/**
+ * Takes a block as input, encrypts it with the expanded key round_keys and writes the ciphertext to out (which may be in)
+ * */
+template <int Nk = ::Nk, int Nr = Nk + 6>
+void Cipher(uint8_t const *round_keys, uint8_t const *in, uint8_t *out)
+{
+    uint8_t state[4 * Nb];
+    for (int i = 0; i < 4 * Nb; i++)
+    {
+        state[i] = in[i];
+    }
+
+    AddRoundKey(state, round_keys, 0);
+
+    for (int i = 1; i < Nr; i++)
+    {
+        SubBytes(state);
+        ShiftRows(state);
+        MixColumns(state);
+        AddRoundKey(state, round_keys, i);
+    }
+
+    SubBytes(state);
+    ShiftRows(state);
+    AddRoundKey(state, round_keys, Nr);
+
+    for (int i = 0; i < 4 * Nb; i++)
+    {
+        out[i] = state[i];
+    }
+}
+
+// ------- The inverse cipher -------
+
+/**
+ * Inverse of SubBytes, with the InvS_box
+ * */
+static void InvSubBytes(uint8_t *const &state)
+{
+    for (int i = 0; i < 4 * Nb; i++)
+    {
+        state[i] = InvS_box[state[i]];
+    }
+}
+
+/**
+ * Inverse of ShiftRows, shifts row r to the right by r positions, so row r of column c is taken from column c - r
+ * */
+static void InvShiftRows(uint8_t *const &state)
+{
+    for (int r = 1; r < 4; r++)
+    {
+        uint8_t row[Nb];
+        for (int c = 0; c < Nb; c++)
+        {
+            row[c] = state[4 * ((c + Nb - r) % Nb) + r];
+        }
+        for (int c = 0; c < Nb; c++)
+        {
+            state[4 * c + r] = row[c];
+        }
+    }
+}
+
+/**
+ * Takes a ciphertext block, decrypts it with the expanded key round_keys (from ExpandKey, the same
+ * as for Cipher) and writes the plaintext to out (which may be in). Section 5.3 of FIPS-197
+ * */
+template <int Nk = ::Nk, int Nr = Nk + 6>
+void InvCipher(uint8_t const *round_keys, uint8_t const *in, uint8_t *out)
+{
+    uint8_t state[4 * Nb];
+    for (int i = 0; i < 4 * Nb; i++)
+    {
+        state[i] = in[i];
+    }
+
+    AddRoundKey(state, round_keys, Nr);
+
+    for (int i = Nr - 1; i > 0; i--)
+    {
+        InvShiftRows(state);
+        InvSubBytes(state);
+        AddRoundKey(state, round_keys, i);
+        InvMixColumns(state);
+    }
+
+    InvShiftRows(state);
+    InvSubBytes(state);
+    AddRoundKey(state, round_keys, 0);
+
+    for (int i = 0; i < 4 * Nb; i++)
+    {
+        out[i] = state[i];
+    }
+}
+
+// The equivalent inverse cipher (section 5.3.5 of FIPS-197) has the round structure of Cipher:
+// InvSubBytes and InvShiftRows commute, and InvMixColumns is linear, so it can be moved in front of
+// AddRoundKey when it is applied to the round key too. Its expanded key, the inverse schedule, is
+// the round keys of ExpandKey in reverse order with InvMixColumns applied to all but the first and
+// the last, so round r of decryption uses round key r like encryption does. The backends then
+// decrypt with the same loop as they encrypt, with inverse T-tables or aesdec.
+
+/**
+ * Builds the inverse schedule for the equivalent inverse cipher from an expanded key of ExpandKey
+ * */
+template <int Nk = ::Nk, int Nr = Nk + 6>
+void InvertSchedule(uint8_t const *schedule, uint8_t *inverse_schedule)
+{
+    for (int round = 0; round <= Nr; round++)
+    {
+        uint8_t *round_key = inverse_schedule + 4 * Nb * round;
+        for (int i = 0; i < 4 * Nb; i++)
+        {
+            round_key[i] = schedule[4 * Nb * (Nr - round) + i];
+        }
+        if (round > 0 && round < Nr)
+        {
+            InvMixColumns(round_key);
+        }
+    }
+}
+
+/**
+ * Decrypts a block like InvCipher, in the order of Cipher with the expanded key inverse_schedule from InvertSchedule
+ * */
+template <int Nk = ::Nk, int Nr = Nk + 6>
+void EqInvCipher(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out)
+{
+    uint8_t state[4 * Nb];
+    for (int i = 0; i < 4 * Nb; i++)
+    {
+        state[i] = in[i];
+    }
+
+    AddRoundKey(state, inverse_schedule, 0);
+
+    for (int i = 1; i < Nr; i++)
+    {
+        InvSubBytes(state);
+        InvShiftRows(state);
+        InvMixColumns(state);
+        AddRoundKey(state, inverse_schedule, i);
+    }
+
+    InvSubBytes(state);
+    InvShiftRows(state);
+    AddRoundKey(state, inverse_schedule, Nr);
+
+    for (int i = 0; i < 4 * Nb; i++)
+    {
+        out[i] = state[i];
+    }
+}
+
+// ------- Fast backends, built on the reference definitions above -------
+#include "aes_ttable.hpp"
+#include "aes_ni.hpp"
+#include "aes_vaes.hpp"
+#include "aes_vperm.hpp"
+#include "aes_bitslice.hpp"
+#include "aes_gfni.hpp"
+#include "aes_dispatch.hpp"
+#include "aes_schedule.hpp"
+#include "aes_parallel.hpp"
+#include "aes_output.hpp"
+#include "aes_stream.hpp"
+#include "aes_mmap.hpp"
+#include "aes_pipeline.hpp"
+#include "aes_uring.hpp"
+#include "aes_splice.hpp"
+#include "aes_ctr.hpp"
+#include "aes_cbc.hpp"
+#include "aes_gcm.hpp"
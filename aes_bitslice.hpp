@@ -0,0 +1,475 @@
+#ifndef AES_BITSLICE_HPP
+#define AES_BITSLICE_HPP
+
+// Bitsliced backends.
+//
+// Several blocks are encrypted together with the state spread over 8 bit planes: byte p of plane b
+// holds bit b of byte p of 8 different blocks. A 128-bit plane carries 8 blocks and a 256-bit plane
+// carries 16, as two 128-bit lanes of 8.
+//  - SubBytes is the 113 gate boolean circuit by Boyar and Peralta, https://eprint.iacr.org/2011/332.pdf
+//  - ShiftRows and the column rotations in MixColumns are byte shuffles of every plane
+//  - multiplying by 02 is a renaming of the planes plus 4 xor's
+//  - InvSubBytes is the same circuit between two inverse affine transforms, which are xor's of planes
+// Packing into planes is a bit matrix transpose done with shifts and masks on whole registers.
+// No memory access depends on the data, so the time does not depend on key or plaintext, unlike
+// the S_box and T-table lookups. The key is expanded with ExpandKey_VPerm, which has the same
+// property.
+//
+// The circuit is written once with GCC vector extensions, and inlined into one function per
+// instruction set so the compiler emits SSSE3 or AVX2 code for it.
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cstring>
+
+#define BITSLICE_INLINE __attribute__((always_inline)) inline
+
+typedef uint8_t Bitslice128 __attribute__((vector_size(16)));
+typedef uint8_t Bitslice256 __attribute__((vector_size(32)));
+
+/**
+ * Swaps the bits of a selected by mask with the bits of b n positions higher. The mask never selects
+ * a bit whose partner is in another byte, so the shift can work on 64-bit lanes
+ * */
+template <typename V>
+BITSLICE_INLINE void bitslice_swap_move(V &a, V &b, int n, uint8_t mask)
+{
+    typedef uint64_t Lanes __attribute__((vector_size(sizeof(V))));
+    V t = (reinterpret_cast<V>(reinterpret_cast<Lanes>(b) >> n) ^ a) & mask;
+    a ^= t;
+    b ^= reinterpret_cast<V>(reinterpret_cast<Lanes>(t) << n);
+}
+
+/**
+ * 8x8 bit matrix transpose of every byte position across the 8 registers: afterwards bit 7 - j of
+ * byte p of x[7 - b] is bit b of byte p of x[j] before. Applying it twice gives back the input
+ * */
+template <typename V>
+BITSLICE_INLINE void bitslice_transpose(V *x)
+{
+    for (int j = 0; j < 8; j += 2)
+    {
+        bitslice_swap_move(x[j], x[j + 1], 1, 0x55);
+    }
+    for (int j = 0; j < 8; j += 4)
+    {
+        bitslice_swap_move(x[j], x[j + 2], 2, 0x33);
+        bitslice_swap_move(x[j + 1], x[j + 3], 2, 0x33);
+    }
+    for (int j = 0; j < 4; j++)
+    {
+        bitslice_swap_move(x[j], x[j + 4], 4, 0x0f);
+    }
+}
+
+/**
+ * Spreads 8 blocks per lane over the 8 bit planes. Lane l of register j starts as block 8 * l + j
+ * */
+template <typename V>
+BITSLICE_INLINE void bitslice_pack(uint8_t const *in, V *planes)
+{
+    const int lanes = sizeof(V) / 16;
+    V x[8];
+    for (int j = 0; j < 8; j++)
+    {
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            std::memcpy(reinterpret_cast<uint8_t *>(&x[j]) + 16 * lane, in + 16 * (8 * lane + j), 16);
+        }
+    }
+    bitslice_transpose(x);
+    for (int b = 0; b < 8; b++)
+    {
+        planes[b] = x[7 - b];
+    }
+}
+
+/**
+ * Inverse of bitslice_pack
+ * */
+template <typename V>
+BITSLICE_INLINE void bitslice_unpack(V const *planes, uint8_t *out)
+{
+    const int lanes = sizeof(V) / 16;
+    V x[8];
+    for (int b = 0; b < 8; b++)
+    {
+        x[7 - b] = planes[b];
+    }
+    bitslice_transpose(x);
+    for (int j = 0; j < 8; j++)
+    {
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            std::memcpy(out + 16 * (8 * lane + j), reinterpret_cast<uint8_t const *>(&x[j]) + 16 * lane, 16);
+        }
+    }
+}
+
+/**
+ * Bitsliced round keys: every byte of plane b of round key r is 0xff if bit b of that key byte is set
+ * */
+template <typename V, int Nr>
+BITSLICE_INLINE void bitslice_round_keys(uint8_t const *schedule, V *round_keys)
+{
+    const int lanes = sizeof(V) / 16;
+    alignas(32) uint8_t bytes[8][sizeof(V)];
+    for (int round = 0; round <= Nr; round++)
+    {
+        for (int b = 0; b < 8; b++)
+        {
+            for (int i = 0; i < 16 * lanes; i++)
+            {
+                bytes[b][i] = (schedule[16 * round + (i % 16)] >> b) & 1 ? 0xff : 0x00;
+            }
+        }
+        std::memcpy(round_keys + 8 * round, bytes, sizeof(bytes));
+    }
+}
+
+// The byte shuffles, within each 128-bit lane. Byte p of the state is row p % 4 of column p / 4.
+// The masks are constants so the compiler can turn each one into a single pshufb/vpshufb
+
+/**
+ * ShiftRows: row r of column c comes from column c + r
+ * */
+BITSLICE_INLINE Bitslice128 bitslice_shift_rows(Bitslice128 v)
+{
+    return __builtin_shuffle(v, Bitslice128{0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11});
+}
+
+BITSLICE_INLINE Bitslice256 bitslice_shift_rows(Bitslice256 v)
+{
+    return __builtin_shuffle(v, Bitslice256{0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11, 16, 21, 26, 31, 20, 25, 30, 19, 24, 29, 18, 23, 28, 17, 22, 27});
+}
+
+/**
+ * InvShiftRows: row r of column c comes from column c - r
+ * */
+BITSLICE_INLINE Bitslice128 bitslice_inv_shift_rows(Bitslice128 v)
+{
+    return __builtin_shuffle(v, Bitslice128{0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3});
+}
+
+BITSLICE_INLINE Bitslice256 bitslice_inv_shift_rows(Bitslice256 v)
+{
+    return __builtin_shuffle(v, Bitslice256{0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3, 16, 29, 26, 23, 20, 17, 30, 27, 24, 21, 18, 31, 28, 25, 22, 19});
+}
+
+/**
+ * Rotates every column up by one row
+ * */
+BITSLICE_INLINE Bitslice128 bitslice_rotate_1(Bitslice128 v)
+{
+    return __builtin_shuffle(v, Bitslice128{1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12});
+}
+
+BITSLICE_INLINE Bitslice256 bitslice_rotate_1(Bitslice256 v)
+{
+    return __builtin_shuffle(v, Bitslice256{1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12, 17, 18, 19, 16, 21, 22, 23, 20, 25, 26, 27, 24, 29, 30, 31, 28});
+}
+
+/**
+ * Rotates every column up by two rows
+ * */
+BITSLICE_INLINE Bitslice128 bitslice_rotate_2(Bitslice128 v)
+{
+    return __builtin_shuffle(v, Bitslice128{2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13});
+}
+
+BITSLICE_INLINE Bitslice256 bitslice_rotate_2(Bitslice256 v)
+{
+    return __builtin_shuffle(v, Bitslice256{2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, 18, 19, 16, 17, 22, 23, 20, 21, 26, 27, 24, 25, 30, 31, 28, 29});
+}
+
+/**
+ * SubBytes on all planes with the Boyar-Peralta circuit. U0 is the most significant bit
+ * */
+template <typename V>
+BITSLICE_INLINE void bitslice_sub_bytes(V *s)
+{
+    const V U0 = s[7], U1 = s[6], U2 = s[5], U3 = s[4], U4 = s[3], U5 = s[2], U6 = s[1], U7 = s[0];
+
+    // top linear layer
+    const V y14 = U3 ^ U5, y13 = U0 ^ U6, y9 = U0 ^ U3, y8 = U0 ^ U5, t0 = U1 ^ U2;
+    const V y1 = t0 ^ U7, y4 = y1 ^ U3, y12 = y13 ^ y14, y2 = y1 ^ U0, y5 = y1 ^ U6;
+    const V y3 = y5 ^ y8, t1 = U4 ^ y12, y15 = t1 ^ U5, y20 = t1 ^ U1, y6 = y15 ^ U7;
+    const V y10 = y15 ^ t0, y11 = y20 ^ y9, y7 = U7 ^ y11, y17 = y10 ^ y11, y19 = y10 ^ y8;
+    const V y16 = t0 ^ y11, y21 = y13 ^ y16, y18 = U0 ^ y16;
+
+    // shared non-linear middle, the inversion in GF(2^4)
+    const V t2 = y12 & y15, t3 = y3 & y6, t4 = t3 ^ t2, t5 = y4 & U7, t6 = t5 ^ t2;
+    const V t7 = y13 & y16, t8 = y5 & y1, t9 = t8 ^ t7, t10 = y2 & y7, t11 = t10 ^ t7;
+    const V t12 = y9 & y11, t13 = y14 & y17, t14 = t13 ^ t12, t15 = y8 & y10, t16 = t15 ^ t12;
+    const V t17 = t4 ^ t14, t18 = t6 ^ t16, t19 = t9 ^ t14, t20 = t11 ^ t16;
+    const V t21 = t17 ^ y20, t22 = t18 ^ y19, t23 = t19 ^ y21, t24 = t20 ^ y18;
+    const V t25 = t21 ^ t22, t26 = t21 & t23, t27 = t24 ^ t26, t28 = t25 & t27, t29 = t28 ^ t22;
+    const V t30 = t23 ^ t24, t31 = t22 ^ t26, t32 = t31 & t30, t33 = t32 ^ t24, t34 = t23 ^ t33;
+    const V t35 = t27 ^ t33, t36 = t24 & t35, t37 = t36 ^ t34, t38 = t27 ^ t36, t39 = t29 & t38;
+    const V t40 = t25 ^ t39, t41 = t40 ^ t37, t42 = t29 ^ t33, t43 = t29 ^ t40, t44 = t33 ^ t37;
+    const V t45 = t42 ^ t41;
+    const V z0 = t44 & y15, z1 = t37 & y6, z2 = t33 & U7, z3 = t43 & y16, z4 = t40 & y1;
+    const V z5 = t29 & y7, z6 = t42 & y11, z7 = t45 & y17, z8 = t41 & y10, z9 = t44 & y12;
+    const V z10 = t37 & y3, z11 = t33 & y4, z12 = t43 & y13, z13 = t40 & y5, z14 = t29 & y2;
+    const V z15 = t42 & y9, z16 = t45 & y14, z17 = t41 & y8;
+
+    // bottom linear layer, including the affine constant 0x63
+    const V t46 = z15 ^ z16, t47 = z10 ^ z11, t48 = z5 ^ z13, t49 = z9 ^ z10, t50 = z2 ^ z12;
+    const V t51 = z2 ^ z5, t52 = z7 ^ z8, t53 = z0 ^ z3, t54 = z6 ^ z7, t55 = z16 ^ z17;
+    const V t56 = z12 ^ t48, t57 = t50 ^ t53, t58 = z4 ^ t46, t59 = z3 ^ t54, t60 = t46 ^ t57;
+    const V t61 = z14 ^ t57, t62 = t52 ^ t58, t63 = t49 ^ t58, t64 = z4 ^ t59, t65 = t61 ^ t62;
+    const V t66 = z1 ^ t63, t67 = t64 ^ t65;
+    const V S3 = t53 ^ t66;
+    s[7] = t59 ^ t63;
+    s[6] = ~(t64 ^ S3);
+    s[5] = ~(t55 ^ t67);
+    s[4] = S3;
+    s[3] = t51 ^ t66;
+    s[2] = t47 ^ t65;
+    s[1] = ~(t56 ^ t62);
+    s[0] = ~(t48 ^ t60);
+}
+
+template <typename V>
+BITSLICE_INLINE void bitslice_shift_rows(V *s)
+{
+    for (int b = 0; b < 8; b++)
+    {
+        s[b] = bitslice_shift_rows(s[b]);
+    }
+}
+
+/**
+ * With r1, r2 the column rotated up by 1 and 2 rows, the new column is
+ * 02 * (s ^ r1) ^ r1 ^ r2(s ^ r1), and 02 * x moves every bit one plane up and folds bit 7 back
+ * into bits 0, 1, 3 and 4 (the polynomial 0x11b)
+ * */
+template <typename V>
+BITSLICE_INLINE void bitslice_mix_columns(V *s)
+{
+    V r1[8], d[8];
+    for (int b = 0; b < 8; b++)
+    {
+        r1[b] = bitslice_rotate_1(s[b]);
+        d[b] = s[b] ^ r1[b];
+    }
+    for (int b = 0; b < 8; b++)
+    {
+        V twice = b == 0 ? d[7] : d[b - 1];
+        if (b == 1 || b == 3 || b == 4)
+        {
+            twice ^= d[7];
+        }
+        s[b] = twice ^ r1[b] ^ bitslice_rotate_2(d[b]);
+    }
+}
+
+/**
+ * The inverse affine transform of the S-box: bit b becomes bits b + 2, b + 5 and b + 7 of the
+ * input, and the constant 0x05 flips bits 0 and 2
+ * */
+template <typename V>
+BITSLICE_INLINE void bitslice_inverse_affine(V *s)
+{
+    V t[8];
+    for (int b = 0; b < 8; b++)
+    {
+        t[b] = s[(b + 2) % 8] ^ s[(b + 5) % 8] ^ s[(b + 7) % 8];
+    }
+    for (int b = 0; b < 8; b++)
+    {
+        s[b] = b == 0 || b == 2 ? ~t[b] : t[b];
+    }
+}
+
+/**
+ * InvSubBytes on all planes. The inverse in GF(2^8) of y is the inverse affine transform of
+ * SubBytes(y), so InvSubBytes(x) = inverse affine(SubBytes(inverse affine(x)))
+ * */
+template <typename V>
+BITSLICE_INLINE void bitslice_inv_sub_bytes(V *s)
+{
+    bitslice_inverse_affine(s);
+    bitslice_sub_bytes(s);
+    bitslice_inverse_affine(s);
+}
+
+template <typename V>
+BITSLICE_INLINE void bitslice_inv_shift_rows(V *s)
+{
+    for (int b = 0; b < 8; b++)
+    {
+        s[b] = bitslice_inv_shift_rows(s[b]);
+    }
+}
+
+/**
+ * InvMixColumns as MixColumns of s ^ 04 * (s ^ r2), see InvMixColumn_SWAR. Multiplying by 04 is
+ * two of the plane renamings of bitslice_mix_columns
+ * */
+template <typename V>
+BITSLICE_INLINE void bitslice_inv_mix_columns(V *s)
+{
+    V d[8], twice[8];
+    for (int b = 0; b < 8; b++)
+    {
+        d[b] = s[b] ^ bitslice_rotate_2(s[b]);
+    }
+    for (int step = 0; step < 2; step++)
+    {
+        for (int b = 0; b < 8; b++)
+        {
+            twice[b] = b == 0 ? d[7] : d[b - 1];
+            if (b == 1 || b == 3 || b == 4)
+            {
+                twice[b] ^= d[7];
+            }
+        }
+        for (int b = 0; b < 8; b++)
+        {
+            d[b] = twice[b];
+        }
+    }
+    for (int b = 0; b < 8; b++)
+    {
+        s[b] ^= d[b];
+    }
+    bitslice_mix_columns(s);
+}
+
+template <typename V>
+BITSLICE_INLINE void bitslice_add_round_key(V *s, V const *round_key)
+{
+    for (int b = 0; b < 8; b++)
+    {
+        s[b] ^= round_key[b];
+    }
+}
+
+/**
+ * Encrypts one group of sizeof(V) / 2 blocks
+ * */
+template <typename V, int Nr>
+BITSLICE_INLINE void bitslice_cipher(V const *round_keys, uint8_t const *in, uint8_t *out)
+{
+    V s[8];
+    bitslice_pack(in, s);
+    bitslice_add_round_key(s, round_keys);
+    for (int round = 1; round < Nr; round++)
+    {
+        bitslice_sub_bytes(s);
+        bitslice_shift_rows(s);
+        bitslice_mix_columns(s);
+        bitslice_add_round_key(s, round_keys + 8 * round);
+    }
+    bitslice_sub_bytes(s);
+    bitslice_shift_rows(s);
+    bitslice_add_round_key(s, round_keys + 8 * Nr);
+    bitslice_unpack(s, out);
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB) a group at a time. The blocks that do not fill a group
+ * go through the vector permute backend, which is also constant time
+ * */
+template <typename V, int Nk, int Nr = Nk + 6>
+BITSLICE_INLINE void bitslice_encrypt_blocks(uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    const size_t group = sizeof(V) / 2;
+    // fewer blocks than a group, as when a mode calls it block by block: skip the round key planes
+    if (nblocks < group)
+    {
+        EncryptBlocks_VPerm<Nk>(schedule, in, out, nblocks);
+        return;
+    }
+    V round_keys[8 * (Nr + 1)];
+    bitslice_round_keys<V, Nr>(schedule, round_keys);
+
+    size_t i = 0;
+    for (; i + group <= nblocks; i += group)
+    {
+        bitslice_cipher<V, Nr>(round_keys, in + 16 * i, out + 16 * i);
+    }
+    EncryptBlocks_VPerm<Nk>(schedule, in + 16 * i, out + 16 * i, nblocks - i);
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB), 8 at a time in 128-bit planes
+ * */
+template <int Nk>
+__attribute__((target("ssse3"))) void EncryptBlocks_BitsliceSSE(uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    bitslice_encrypt_blocks<Bitslice128, Nk>(schedule, in, out, nblocks);
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB), 16 at a time in 256-bit planes
+ * */
+template <int Nk>
+__attribute__((target("avx2"))) void EncryptBlocks_BitsliceAVX2(uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    bitslice_encrypt_blocks<Bitslice256, Nk>(schedule, in, out, nblocks);
+}
+
+/**
+ * Decrypts one group of sizeof(V) / 2 blocks with the equivalent inverse cipher
+ * */
+template <typename V, int Nr>
+BITSLICE_INLINE void bitslice_inverse_cipher(V const *round_keys, uint8_t const *in, uint8_t *out)
+{
+    V s[8];
+    bitslice_pack(in, s);
+    bitslice_add_round_key(s, round_keys);
+    for (int round = 1; round < Nr; round++)
+    {
+        bitslice_inv_sub_bytes(s);
+        bitslice_inv_shift_rows(s);
+        bitslice_inv_mix_columns(s);
+        bitslice_add_round_key(s, round_keys + 8 * round);
+    }
+    bitslice_inv_sub_bytes(s);
+    bitslice_inv_shift_rows(s);
+    bitslice_add_round_key(s, round_keys + 8 * Nr);
+    bitslice_unpack(s, out);
+}
+
+/**
+ * Decrypts nblocks consecutive blocks (ECB) a group at a time, the rest with the vector permute
+ * backend. inverse_schedule is from InvertSchedule
+ * */
+template <typename V, int Nk, int Nr = Nk + 6>
+BITSLICE_INLINE void bitslice_decrypt_blocks(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    const size_t group = sizeof(V) / 2;
+    // fewer blocks than a group, as when a mode calls it block by block: skip the round key planes
+    if (nblocks < group)
+    {
+        DecryptBlocks_VPerm<Nk>(inverse_schedule, in, out, nblocks);
+        return;
+    }
+    V round_keys[8 * (Nr + 1)];
+    bitslice_round_keys<V, Nr>(inverse_schedule, round_keys);
+
+    size_t i = 0;
+    for (; i + group <= nblocks; i += group)
+    {
+        bitslice_inverse_cipher<V, Nr>(round_keys, in + 16 * i, out + 16 * i);
+    }
+    DecryptBlocks_VPerm<Nk>(inverse_schedule, in + 16 * i, out + 16 * i, nblocks - i);
+}
+
+template <int Nk>
+__attribute__((target("ssse3"))) void DecryptBlocks_BitsliceSSE(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    bitslice_decrypt_blocks<Bitslice128, Nk>(inverse_schedule, in, out, nblocks);
+}
+
+template <int Nk>
+__attribute__((target("avx2"))) void DecryptBlocks_BitsliceAVX2(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    bitslice_decrypt_blocks<Bitslice256, Nk>(inverse_schedule, in, out, nblocks);
+}
+
+#endif
+
+#endif
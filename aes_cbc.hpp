@@ -0,0 +1,207 @@
+#ifndef AES_CBC_HPP
+#define AES_CBC_HPP
+
+// Cipher block chaining (CBC) mode.
+//
+// C_i = E(P_i ^ C_i-1) with C_-1 = IV (NIST SP 800-38A, section 6.2). Every block of a stream
+// waits for the one before it, so one stream only ever has one block in the AES pipeline:
+//  - decryption, P_i = D(C_i) ^ C_i-1, only needs ciphertext, so a batch of blocks is decrypted
+//    with the backend's ECB function (all its blocks in flight) and then xor'ed with the
+//    ciphertext shifted by one block. Long texts are split over the pool, every chunk starts from
+//    the last ciphertext block of the chunk before it
+//  - encryption of one stream stays serial, but independent streams (files, messages) do not
+//    depend on each other: cbc_encrypt_streams steps up to CBC_LANES of them together, one block
+//    of each per call to the backend, so those blocks are in flight at the same time
+// The iv is updated to the last ciphertext block, so the next call continues the same stream.
+// Like ECB the text is whole blocks, a trailing partial block is padded with zero bytes by the
+// callers. The file version maps the input and output like the memory-mapped file mode.
+
+#include <cstring>
+#include <vector>
+
+// blocks decrypted together, 2 KB of plaintext on the stack
+static const size_t CBC_BATCH_BLOCKS = 128;
+// streams encrypted side by side, the blocks in flight of the AES-NI and VAES backends
+static const size_t CBC_LANES = 8;
+
+static inline void xor_block(uint8_t const *a, uint8_t const *b, uint8_t *out)
+{
+    typedef uint8_t Block __attribute__((vector_size(16)));
+    Block x, y;
+    std::memcpy(&x, a, 16);
+    std::memcpy(&y, b, 16);
+    x ^= y;
+    std::memcpy(out, &x, 16);
+}
+
+/**
+ * Encrypts nblocks blocks of one stream in CBC mode, one block at a time. out may be equal to in
+ * */
+static void cbc_encrypt(Schedule const &schedule, uint8_t *iv, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    uint8_t block[16];
+    for (size_t i = 0; i < nblocks; i++)
+    {
+        xor_block(in + 16 * i, iv, block);
+        schedule.encrypt_blocks(block, iv, 1);
+        std::memcpy(out + 16 * i, iv, 16);
+    }
+}
+
+/**
+ * Decrypts nblocks blocks in CBC mode on the calling thread, a batch at a time. out may be equal to
+ * in: a batch is decrypted aside and the last ciphertext block is kept before the batch is written
+ * */
+static void cbc_decrypt(Schedule const &schedule, uint8_t *iv, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    uint8_t plaintext[16 * CBC_BATCH_BLOCKS];
+    for (size_t first = 0; first < nblocks; first += CBC_BATCH_BLOCKS)
+    {
+        const size_t count = nblocks - first < CBC_BATCH_BLOCKS ? nblocks - first : CBC_BATCH_BLOCKS;
+        uint8_t const *ciphertext = in + 16 * first;
+        schedule.decrypt_blocks(ciphertext, plaintext, count);
+        xor_block(plaintext, iv, plaintext);
+        for (size_t b = 1; b < count; b++)
+        {
+            xor_block(plaintext + 16 * b, ciphertext + 16 * (b - 1), plaintext + 16 * b);
+        }
+        std::memcpy(iv, ciphertext + 16 * (count - 1), 16);
+        std::memcpy(out + 16 * first, plaintext, 16 * count);
+    }
+}
+
+/**
+ * Like cbc_decrypt, on all threads of the pool. The ciphertext block in front of every chunk is
+ * copied first, so out may still be equal to in. Small inputs are decrypted on the calling thread
+ * */
+static void cbc_decrypt_parallel(Schedule const &schedule, uint8_t *iv, uint8_t const *in, uint8_t *out, size_t nblocks,
+                          LazyPool pool = LazyPool())
+{
+    if (nblocks < PARALLEL_MIN_BLOCKS || pool.get().size() == 1)
+    {
+        cbc_decrypt(schedule, iv, in, out, nblocks);
+        return;
+    }
+    const size_t chunks = (nblocks + PARALLEL_CHUNK_BLOCKS - 1) / PARALLEL_CHUNK_BLOCKS;
+    std::vector<uint8_t> previous(16 * chunks);
+    std::memcpy(previous.data(), iv, 16);
+    for (size_t chunk = 1; chunk < chunks; chunk++)
+    {
+        std::memcpy(&previous[16 * chunk], in + 16 * (chunk * PARALLEL_CHUNK_BLOCKS - 1), 16);
+    }
+    std::memcpy(iv, in + 16 * (nblocks - 1), 16);
+    pool.get().parallel_for(chunks, [&](size_t chunk) {
+        size_t first = chunk * PARALLEL_CHUNK_BLOCKS;
+        size_t count = nblocks - first < PARALLEL_CHUNK_BLOCKS ? nblocks - first : PARALLEL_CHUNK_BLOCKS;
+        cbc_decrypt(schedule, &previous[16 * chunk], in + 16 * first, out + 16 * first, count);
+    });
+}
+
+/**
+ * One CBC stream for cbc_encrypt_streams
+ * */
+struct CbcStream
+{
+    // the chaining value, updated like the iv of cbc_encrypt
+    uint8_t iv[16];
+    uint8_t const *in;
+    uint8_t *out;
+    size_t nblocks;
+};
+
+/**
+ * Encrypts count independent streams in CBC mode, with the next block of up to CBC_LANES of them
+ * encrypted by one call to the backend. A lane whose stream is done takes the next stream, so
+ * streams of different lengths keep the lanes full. Gives the same result as cbc_encrypt on each stream
+ * */
+static inline void cbc_encrypt_streams(Schedule const &schedule, CbcStream *streams, size_t count)
+{
+    CbcStream *lanes[CBC_LANES];
+    size_t positions[CBC_LANES];
+    size_t active = 0, next = 0;
+    uint8_t blocks[16 * CBC_LANES];
+    while (true)
+    {
+        // fill the free lanes with streams that still have blocks
+        for (; active < CBC_LANES && next < count; next++)
+        {
+            if (streams[next].nblocks > 0)
+            {
+                lanes[active] = &streams[next];
+                positions[active] = 0;
+                active++;
+            }
+        }
+        if (active == 0)
+        {
+            return;
+        }
+
+        for (size_t lane = 0; lane < active; lane++)
+        {
+            xor_block(lanes[lane]->in + 16 * positions[lane], lanes[lane]->iv, blocks + 16 * lane);
+        }
+        schedule.encrypt_blocks(blocks, blocks, active);
+
+        // write the blocks out, and close the lanes whose stream is done by moving the last lane into them
+        for (size_t lane = 0; lane < active;)
+        {
+            CbcStream &stream = *lanes[lane];
+            std::memcpy(stream.iv, blocks + 16 * lane, 16);
+            std::memcpy(stream.out + 16 * positions[lane], blocks + 16 * lane, 16);
+            if (++positions[lane] < stream.nblocks)
+            {
+                lane++;
+                continue;
+            }
+            active--;
+            lanes[lane] = lanes[active];
+            positions[lane] = positions[active];
+            std::memcpy(blocks + 16 * lane, blocks + 16 * active, 16);
+        }
+    }
+}
+
+/**
+ * Encrypts (with the plaintext padded to whole blocks) or decrypts the file in_path, the key of
+ * key_size bytes followed by the text, in CBC mode into out_path. Returns false after printing the
+ * reason if a file cannot be opened, mapped or allocated, or a ciphertext is not whole blocks
+ * */
+static bool cbc_file(char const *in_path, char const *out_path, uint8_t *iv, bool decrypt, size_t key_size = KEY_SIZE)
+{
+    MappedFile input;
+    if (!input.open_input(in_path))
+    {
+        return false;
+    }
+    if (input.size < key_size || (decrypt && (input.size - key_size) % 16 != 0))
+    {
+        std::cerr << in_path << " is not a key followed by " << (decrypt ? "whole blocks" : "a plaintext") << std::endl;
+        return false;
+    }
+    const Schedule schedule(input.data, key_size);
+    uint8_t const *text = input.data + key_size;
+    const size_t text_size = input.size - key_size;
+
+    MappedFile output;
+    if (!output.open_output(out_path, (text_size + 15) / 16 * 16, input.fd))
+    {
+        return false;
+    }
+    if (decrypt)
+    {
+        cbc_decrypt_parallel(schedule, iv, text, output.data, text_size / 16);
+        return true;
+    }
+    const size_t whole_blocks = text_size / 16;
+    cbc_encrypt(schedule, iv, text, output.data, whole_blocks);
+    if (text_size % 16 != 0)
+    {
+        uint8_t last[16] = {};
+        std::memcpy(last, text + 16 * whole_blocks, text_size % 16);
+        cbc_encrypt(schedule, iv, last, output.data + 16 * whole_blocks, 1);
+    }
+    return true;
+}
+
+#endif
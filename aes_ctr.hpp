@@ -0,0 +1,188 @@
+#ifndef AES_CTR_HPP
+#define AES_CTR_HPP
+
+// Counter (CTR) mode.
+//
+// Byte p of the stream is xor'ed with byte p % 16 of E(IV + p / 16), where the counter block is a
+// 128-bit big endian number (NIST SP 800-38A, section 6.5). Encryption and decryption are the same
+// operation, and the text is not padded: a trailing partial block only uses the start of its
+// keystream block.
+// Every keystream block only depends on its position, so:
+//  - the counter blocks of a batch are written out and encrypted with the backend's ECB function,
+//    which keeps its SIMD lanes and blocks in flight busy as it does for ECB
+//  - the pool splits a long text into chunks that each start from their own counter
+//  - a slice of the stream can be processed on its own by passing its byte offset, without
+//    touching what comes before it
+// The file version maps the input and output like the memory-mapped file mode.
+
+#include <cstring>
+
+// counter blocks encrypted together, 2 KB of counters and 2 KB of keystream on the stack
+static const size_t CTR_BATCH_BLOCKS = 128;
+
+/**
+ * Byte order conversion for the halves of a counter block, a no-op on big endian hosts
+ * */
+static inline uint64_t big_endian_64(uint64_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap64(value);
+#else
+    return value;
+#endif
+}
+
+static inline uint64_t load_big_endian_64(uint8_t const *bytes)
+{
+    uint64_t value;
+    std::memcpy(&value, bytes, 8);
+    return big_endian_64(value);
+}
+
+static inline void store_big_endian_64(uint8_t *bytes, uint64_t value)
+{
+    value = big_endian_64(value);
+    std::memcpy(bytes, &value, 8);
+}
+
+/**
+ * Sets counter to iv + blocks, as 128-bit big endian numbers
+ * */
+static void ctr_counter_at(uint8_t const *iv, uint64_t blocks, uint8_t *counter)
+{
+    uint64_t high = load_big_endian_64(iv), low = load_big_endian_64(iv + 8);
+    uint64_t sum = low + blocks;
+    store_big_endian_64(counter, sum < low ? high + 1 : high);
+    store_big_endian_64(counter + 8, sum);
+}
+
+/**
+ * xor's length bytes of in with the keystream into out
+ * */
+static inline void xor_keystream(uint8_t const *keystream, uint8_t const *in, uint8_t *out, size_t length)
+{
+    typedef uint8_t Block __attribute__((vector_size(16)));
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        Block a, b;
+        std::memcpy(&a, in + i, 16);
+        std::memcpy(&b, keystream + i, 16);
+        a ^= b;
+        std::memcpy(out + i, &a, 16);
+    }
+    for (; i < length; i++)
+    {
+        out[i] = in[i] ^ keystream[i];
+    }
+}
+
+/**
+ * CTR on length bytes that start at the beginning of the keystream block counter, a batch of
+ * counter blocks at a time. out may be equal to in
+ * */
+static void ctr_from_block(Schedule const &schedule, uint8_t const *counter, uint8_t const *in, uint8_t *out, size_t length)
+{
+    uint8_t counters[16 * CTR_BATCH_BLOCKS], keystream[16 * CTR_BATCH_BLOCKS];
+    uint64_t high = load_big_endian_64(counter), low = load_big_endian_64(counter + 8);
+    for (size_t done = 0; done < length;)
+    {
+        const size_t bytes = length - done < sizeof(keystream) ? length - done : sizeof(keystream);
+        const size_t nblocks = (bytes + 15) / 16;
+        for (size_t b = 0; b < nblocks; b++)
+        {
+            store_big_endian_64(counters + 16 * b, high);
+            store_big_endian_64(counters + 16 * b + 8, low);
+            if (++low == 0)
+            {
+                high++;
+            }
+        }
+        schedule.encrypt_blocks(counters, keystream, nblocks);
+        xor_keystream(keystream, in + done, out + done, bytes);
+        done += bytes;
+    }
+}
+
+/**
+ * Encrypts or decrypts length bytes in CTR mode with the 16 byte initial counter block iv, on the
+ * calling thread. in is the part of the stream that starts offset bytes in, so any slice can be
+ * processed on its own. out may be equal to in
+ * */
+static void ctr_crypt(Schedule const &schedule, uint8_t const *iv, uint64_t offset, uint8_t const *in, uint8_t *out, size_t length)
+{
+    uint8_t counter[16];
+    ctr_counter_at(iv, offset / 16, counter);
+
+    // the rest of the block that offset is in
+    const size_t skip = offset % 16;
+    if (skip != 0 && length > 0)
+    {
+        uint8_t keystream[16];
+        schedule.encrypt_blocks(counter, keystream, 1);
+        const size_t bytes = length < 16 - skip ? length : 16 - skip;
+        xor_keystream(keystream + skip, in, out, bytes);
+        in += bytes;
+        out += bytes;
+        length -= bytes;
+        ctr_counter_at(iv, offset / 16 + 1, counter);
+    }
+    ctr_from_block(schedule, counter, in, out, length);
+}
+
+/**
+ * Like ctr_crypt, on all threads of the pool. The text is cut into chunks of whole keystream
+ * blocks and every chunk computes its own first counter. Small inputs run on the calling thread
+ * */
+static void ctr_crypt_parallel(Schedule const &schedule, uint8_t const *iv, uint64_t offset, uint8_t const *in, uint8_t *out,
+                        size_t length, LazyPool pool = LazyPool())
+{
+    const size_t chunk_size = 16 * PARALLEL_CHUNK_BLOCKS;
+    // up to the first block boundary of the stream, so the chunks after it start on one
+    const size_t head = offset % 16 == 0 ? 0 : 16 - offset % 16;
+    if (length < head + 16 * PARALLEL_MIN_BLOCKS || pool.get().size() == 1)
+    {
+        ctr_crypt(schedule, iv, offset, in, out, length);
+        return;
+    }
+    ctr_crypt(schedule, iv, offset, in, out, head);
+    const uint64_t first_block = (offset + head) / 16;
+    const size_t rest = length - head;
+    const size_t chunks = (rest + chunk_size - 1) / chunk_size;
+    pool.get().parallel_for(chunks, [&](size_t chunk) {
+        const size_t start = head + chunk * chunk_size;
+        const size_t bytes = length - start < chunk_size ? length - start : chunk_size;
+        uint8_t counter[16];
+        ctr_counter_at(iv, first_block + chunk * PARALLEL_CHUNK_BLOCKS, counter);
+        ctr_from_block(schedule, counter, in + start, out + start, bytes);
+    });
+}
+
+/**
+ * Encrypts or decrypts the file in_path (the key of key_size bytes followed by the text) in CTR
+ * mode into out_path, which gets exactly as many bytes as the text. offset is the position of the
+ * text in the stream. Returns false after printing the reason if a file cannot be opened, mapped or allocated
+ * */
+static bool ctr_file(char const *in_path, char const *out_path, uint8_t const *iv, uint64_t offset, size_t key_size = KEY_SIZE)
+{
+    MappedFile input;
+    if (!input.open_input(in_path))
+    {
+        return false;
+    }
+    if (input.size < key_size)
+    {
+        std::cerr << in_path << " is too short for a key" << std::endl;
+        return false;
+    }
+    const Schedule schedule(input.data, key_size);
+    MappedFile output;
+    if (!output.open_output(out_path, input.size - key_size, input.fd))
+    {
+        return false;
+    }
+    ctr_crypt_parallel(schedule, iv, offset, input.data + key_size, output.data, input.size - key_size);
+    return true;
+}
+
+#endif
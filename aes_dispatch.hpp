@@ -0,0 +1,270 @@
+#ifndef AES_DISPATCH_HPP
+#define AES_DISPATCH_HPP
+
+// Runtime backend selection.
+//
+// Every backend expands a key into the layout of ExpandKey and encrypts a run of blocks from it,
+// and inverts the expanded key like InvertSchedule and decrypts a run of blocks from that, with
+// one instance of each function per key size.
+// The fastest one the cpu supports, and that does not slow down the rest of the process, is
+// picked once from what CPUID reports.
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+typedef void (*ExpandKeyFunction)(uint8_t const *cipher_key, uint8_t *schedule);
+typedef void (*EncryptBlocksFunction)(uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t nblocks);
+typedef void (*InvertScheduleFunction)(uint8_t const *schedule, uint8_t *inverse_schedule);
+typedef void (*DecryptBlocksFunction)(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks);
+
+// the key sizes in bytes, in the order of the functions of a Backend
+static const size_t KEY_SIZES[] = {16, 24, 32};
+static const int KEY_SIZE_COUNT = 3;
+
+/**
+ * Position of a key size (in bytes) in KEY_SIZES, -1 if AES has no such key size
+ * */
+static int key_size_index(size_t key_size)
+{
+    for (int i = 0; i < KEY_SIZE_COUNT; i++)
+    {
+        if (KEY_SIZES[i] == key_size)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+struct Backend
+{
+    char const *name;
+    bool (*supported)();
+    // false if the backend should only be used when asked for by name
+    bool (*preferred)();
+    // true if the backend runs on AES-NI, so modes may run their own aesenc loops on its schedule
+    bool aesni;
+    // indexed by key_size_index: AES-128, AES-192 and AES-256
+    ExpandKeyFunction expand_key[KEY_SIZE_COUNT];
+    EncryptBlocksFunction encrypt_blocks[KEY_SIZE_COUNT];
+    InvertScheduleFunction invert_schedule[KEY_SIZE_COUNT];
+    DecryptBlocksFunction decrypt_blocks[KEY_SIZE_COUNT];
+};
+
+// the instances of a function template for Nk = 4, 6 and 8
+#define FOR_EACH_KEY_SIZE(function) {function<4>, function<6>, function<8>}
+
+/**
+ * The portable backends run everywhere
+ * */
+static bool always_supported()
+{
+    return true;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * CPUID.01H:ECX.AES[bit 25]
+ * */
+static bool cpu_has_aesni()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+    return (ecx & bit_AES) != 0;
+}
+
+/**
+ * The register state the OS saves on context switches (XCR0), 0 if the OS does not support xgetbv
+ * */
+static uint64_t os_saved_state()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || (ecx & bit_OSXSAVE) == 0)
+    {
+        return 0;
+    }
+    uint32_t low, high;
+    __asm__ volatile("xgetbv"
+                     : "=a"(low), "=d"(high)
+                     : "c"(0));
+    return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+/**
+ * CPUID.07H.0:EBX/ECX feature bits, 0 if the leaf does not exist
+ * */
+static void extended_features(unsigned int &ebx, unsigned int &ecx)
+{
+    unsigned int eax, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    {
+        ebx = 0;
+        ecx = 0;
+    }
+}
+
+/**
+ * CPUID.01H:ECX.SSSE3[bit 9], for pshufb
+ * */
+static bool cpu_has_ssse3()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+    return (ecx & bit_SSSE3) != 0;
+}
+
+/**
+ * AVX2 needs the OS to save the ymm registers (XCR0 bits 1 and 2)
+ * */
+static bool cpu_has_avx2()
+{
+    unsigned int ebx, ecx;
+    extended_features(ebx, ecx);
+    return (ebx & bit_AVX2) != 0 && (os_saved_state() & 0x06) == 0x06;
+}
+
+/**
+ * CPUID.07H.0:ECX.GFNI[bit 8]. The backend also uses pshufb
+ * */
+static bool cpu_has_gfni()
+{
+    unsigned int ebx, ecx;
+    extended_features(ebx, ecx);
+    return cpu_has_ssse3() && (ecx & bit_GFNI) != 0;
+}
+
+static bool cpu_has_gfni_avx2()
+{
+    return cpu_has_gfni() && cpu_has_avx2();
+}
+
+/**
+ * VAES on ymm registers needs AVX2 and the OS to save the ymm registers (XCR0 bits 1 and 2)
+ * */
+static bool cpu_has_vaes256()
+{
+    unsigned int ebx, ecx;
+    extended_features(ebx, ecx);
+    return cpu_has_aesni() && cpu_has_avx2() && (ecx & bit_VAES) != 0;
+}
+
+/**
+ * VAES on zmm registers also needs AVX-512F and the OS to save the opmask and zmm registers (XCR0 bits 5 to 7)
+ * */
+static bool cpu_has_vaes512()
+{
+    unsigned int ebx, ecx;
+    extended_features(ebx, ecx);
+    return cpu_has_vaes256() && (ebx & bit_AVX512F) != 0 && (os_saved_state() & 0xe6) == 0xe6;
+}
+
+/**
+ * Intel cores drop to a lower frequency licence while 512-bit instructions run, which also slows
+ * every other thread on the core and lasts for a while after the last one. AMD Zen 4 runs them as
+ * two 256-bit halves without downclocking, so only prefer the zmm backend there.
+ * AES_VECTOR_WIDTH=256 or 512 overrides the guess
+ * */
+static bool prefer_512_bit()
+{
+    char const *width = std::getenv("AES_VECTOR_WIDTH");
+    if (width != nullptr)
+    {
+        return std::strcmp(width, "512") == 0;
+    }
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+    return ebx == signature_AMD_ebx && ecx == signature_AMD_ecx && edx == signature_AMD_edx;
+}
+#endif
+
+// all backends, fastest first
+static const Backend BACKENDS[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"vaes512", cpu_has_vaes512, prefer_512_bit, true, FOR_EACH_KEY_SIZE(ExpandKey_AESNI), FOR_EACH_KEY_SIZE(EncryptBlocks_VAES512),
+     FOR_EACH_KEY_SIZE(InvertSchedule_AESNI), FOR_EACH_KEY_SIZE(DecryptBlocks_VAES512)},
+    {"vaes256", cpu_has_vaes256, always_supported, true, FOR_EACH_KEY_SIZE(ExpandKey_AESNI), FOR_EACH_KEY_SIZE(EncryptBlocks_VAES256),
+     FOR_EACH_KEY_SIZE(InvertSchedule_AESNI), FOR_EACH_KEY_SIZE(DecryptBlocks_VAES256)},
+    {"aesni", cpu_has_aesni, always_supported, true, FOR_EACH_KEY_SIZE(ExpandKey_AESNI), FOR_EACH_KEY_SIZE(EncryptBlocks_AESNI),
+     FOR_EACH_KEY_SIZE(InvertSchedule_AESNI), FOR_EACH_KEY_SIZE(DecryptBlocks_AESNI)},
+    {"gfni_avx2", cpu_has_gfni_avx2, always_supported, false, FOR_EACH_KEY_SIZE(ExpandKey_GFNI), FOR_EACH_KEY_SIZE(EncryptBlocks_GFNI256),
+     FOR_EACH_KEY_SIZE(InvertSchedule), FOR_EACH_KEY_SIZE(DecryptBlocks_GFNI256)},
+    {"gfni", cpu_has_gfni, always_supported, false, FOR_EACH_KEY_SIZE(ExpandKey_GFNI), FOR_EACH_KEY_SIZE(EncryptBlocks_GFNI),
+     FOR_EACH_KEY_SIZE(InvertSchedule), FOR_EACH_KEY_SIZE(DecryptBlocks_GFNI)},
+    {"bitslice_avx2", cpu_has_avx2, always_supported, false, FOR_EACH_KEY_SIZE(ExpandKey_VPerm), FOR_EACH_KEY_SIZE(EncryptBlocks_BitsliceAVX2),
+     FOR_EACH_KEY_SIZE(InvertSchedule), FOR_EACH_KEY_SIZE(DecryptBlocks_BitsliceAVX2)},
+    {"bitslice_sse", cpu_has_ssse3, always_supported, false, FOR_EACH_KEY_SIZE(ExpandKey_VPerm), FOR_EACH_KEY_SIZE(EncryptBlocks_BitsliceSSE),
+     FOR_EACH_KEY_SIZE(InvertSchedule), FOR_EACH_KEY_SIZE(DecryptBlocks_BitsliceSSE)},
+    {"vperm", cpu_has_ssse3, always_supported, false, FOR_EACH_KEY_SIZE(ExpandKey_VPerm), FOR_EACH_KEY_SIZE(EncryptBlocks_VPerm),
+     FOR_EACH_KEY_SIZE(InvertSchedule), FOR_EACH_KEY_SIZE(DecryptBlocks_VPerm)},
+#endif
+    {"ttable", always_supported, always_supported, false, FOR_EACH_KEY_SIZE(ExpandKey), FOR_EACH_KEY_SIZE(EncryptBlocks_TTable),
+     FOR_EACH_KEY_SIZE(InvertSchedule), FOR_EACH_KEY_SIZE(DecryptBlocks_TTable)},
+};
+
+static const size_t BACKEND_COUNT = sizeof(BACKENDS) / sizeof(BACKENDS[0]);
+
+/**
+ * Returns the backend with the given name, or nullptr if there is none or the cpu does not support it
+ * */
+static Backend const *FindBackend(char const *name)
+{
+    for (size_t i = 0; i < BACKEND_COUNT; i++)
+    {
+        if (std::strcmp(BACKENDS[i].name, name) == 0 && BACKENDS[i].supported())
+        {
+            return &BACKENDS[i];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Picks the fastest supported and preferred backend. The AES_BACKEND environment variable can force a specific
+ * one, e.g. AES_BACKEND=ttable to run the portable code on an AES-NI machine
+ * */
+static Backend const *pick_backend()
+{
+    char const *forced = std::getenv("AES_BACKEND");
+    if (forced != nullptr)
+    {
+        Backend const *backend = FindBackend(forced);
+        if (backend != nullptr)
+        {
+            return backend;
+        }
+        std::cerr << "AES_BACKEND=" << forced << " is not available, picking one" << std::endl;
+    }
+    for (size_t i = 0; i < BACKEND_COUNT; i++)
+    {
+        if (BACKENDS[i].supported() && BACKENDS[i].preferred())
+        {
+            return &BACKENDS[i];
+        }
+    }
+    // the portable backends are always supported
+    return &BACKENDS[BACKEND_COUNT - 1];
+}
+
+/**
+ * The backend used by main, chosen on the first call
+ * */
+static Backend const &SelectBackend()
+{
+    static Backend const *selected = pick_backend();
+    return *selected;
+}
+
+#endif
@@ -0,0 +1,488 @@
+#ifndef AES_GCM_HPP
+#define AES_GCM_HPP
+
+// Galois/Counter Mode (GCM).
+//
+// NIST SP 800-38D: the text is encrypted in counter mode from inc32(J0), where only the low 32 bits
+// of the counter block count, and GHASH, a polynomial in H = E(0) over GF(2^128), authenticates the
+// additional data and the ciphertext. The tag is E(J0) ^ GHASH.
+// GHASH is Horner's rule, Y = (Y ^ X_i) * H, one multiplication waiting for the other. With the
+// powers H, H^2 .. H^GCM_AGGREGATE computed once per key, a group of blocks is folded in together:
+// Y = (Y ^ X_1) * H^8 ^ X_2 * H^7 ^ ... ^ X_8 * H. The eight products are independent, and only
+// their sum is reduced modulo the polynomial (aggregated reduction, from Gueron and Kounavis'
+// white paper on carry-less multiplication and GCM).
+// When the Schedule's backend uses AES-NI and the cpu has PCLMULQDQ, one loop runs the rounds of
+// a group of counter blocks and the GHASH of the group before it, so the aesenc and pclmulqdq units
+// work side by side. Other backends fill a batch of keystream with their ECB function and hash it
+// with pclmulqdq, or bit by bit as in the standard on cpus without it.
+
+#include <cstring>
+
+// blocks hashed together with the powers of H, and counter blocks in flight in the stitched loop
+static const int GCM_AGGREGATE = 8;
+// counter blocks encrypted together by the backend's ECB function, 2 KB of keystream on the stack
+static const size_t GCM_BATCH_BLOCKS = 128;
+// the longest text in bytes, 2^32 - 2 blocks (SP 800-38D, section 5.2.1.1), after that inc32 would
+// reach the counter block of the tag again
+static const uint64_t GCM_MAX_LENGTH = 16 * ((static_cast<uint64_t>(1) << 32) - 2);
+
+/**
+ * X * Y in GF(2^128), bit by bit (SP 800-38D, Algorithm 1). The blocks are in the byte order of
+ * the standard, product may be equal to x or y. Y is the hash key, so its bits and the bits of X
+ * select with masks rather than branches
+ * */
+static void ghash_multiply(uint8_t const *x, uint8_t const *y, uint8_t *product)
+{
+    uint64_t z_high = 0, z_low = 0;
+    uint64_t v_high = load_big_endian_64(y), v_low = load_big_endian_64(y + 8);
+    for (int i = 0; i < 128; i++)
+    {
+        const uint64_t bit = (x[i / 8] >> (7 - i % 8)) & 1;
+        z_high ^= v_high & (0 - bit);
+        z_low ^= v_low & (0 - bit);
+        // V * x, with R = 11100001 || 0^120 for the bit that falls off
+        const uint64_t carry = v_low & 1;
+        v_low = (v_low >> 1) | (v_high << 63);
+        v_high = (v_high >> 1) ^ (0xe100000000000000 & (0 - carry));
+    }
+    store_big_endian_64(product, z_high);
+    store_big_endian_64(product + 8, z_low);
+}
+
+/**
+ * inc32: adds one to the last 32 bits of the counter block, big endian, modulo 2^32
+ * */
+static inline void gcm_increment(uint8_t *counter)
+{
+    for (int i = 15; i >= 12; i--)
+    {
+        if (++counter[i] != 0)
+        {
+            return;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define CLMUL_TARGET __attribute__((target("pclmul,ssse3")))
+#define GCM_TARGET __attribute__((target("aes,pclmul,ssse3")))
+
+/**
+ * CPUID.01H:ECX.PCLMULQDQ[bit 1]. The GHASH code also uses pshufb
+ * */
+static bool cpu_has_pclmul()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+    return cpu_has_ssse3() && (ecx & bit_PCLMUL) != 0;
+}
+
+/**
+ * Reverses the bytes of a block. GHASH reads a block as a polynomial with the coefficient of x^0
+ * in the top bit of byte 0, byte swapped the coefficients are in order from bit 127 down, as
+ * pclmulqdq multiplies them (shifted by one bit, which clmul_reduce corrects)
+ * */
+CLMUL_TARGET static inline __m128i clmul_byte_swap(__m128i block)
+{
+    return _mm_shuffle_epi8(block, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+/**
+ * Adds the 256-bit carry-less product of a and b into low and high, without reducing it
+ * */
+CLMUL_TARGET static inline void clmul_accumulate(__m128i a, __m128i b, __m128i &low, __m128i &high)
+{
+    __m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+    low = _mm_xor_si128(low, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(middle, 8)));
+    high = _mm_xor_si128(high, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(middle, 8)));
+}
+
+/**
+ * Reduces a 256-bit product of byte swapped blocks modulo x^128 + x^7 + x^2 + x + 1: shifts it
+ * left by one bit for the reflected bit order, then folds the low half into the high half
+ * (Algorithm 5 of the white paper)
+ * */
+CLMUL_TARGET static inline __m128i clmul_reduce(__m128i low, __m128i high)
+{
+    __m128i low_carries = _mm_srli_epi32(low, 31);
+    __m128i high_carries = _mm_srli_epi32(high, 31);
+    low = _mm_slli_epi32(low, 1);
+    high = _mm_slli_epi32(high, 1);
+    high = _mm_or_si128(high, _mm_srli_si128(low_carries, 12));
+    high = _mm_or_si128(high, _mm_slli_si128(high_carries, 4));
+    low = _mm_or_si128(low, _mm_slli_si128(low_carries, 4));
+
+    __m128i fold = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+    low = _mm_xor_si128(low, _mm_slli_si128(fold, 12));
+    __m128i rest = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+    rest = _mm_xor_si128(rest, _mm_srli_si128(fold, 4));
+    return _mm_xor_si128(high, _mm_xor_si128(low, rest));
+}
+
+/**
+ * H, H^2 .. H^GCM_AGGREGATE byte swapped into powers, for the pclmulqdq code
+ * */
+CLMUL_TARGET static void clmul_powers(uint8_t const *h, uint8_t *powers)
+{
+    const __m128i h_swapped = clmul_byte_swap(_mm_loadu_si128(reinterpret_cast<__m128i const *>(h)));
+    __m128i power = h_swapped;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(powers), power);
+    for (int k = 1; k < GCM_AGGREGATE; k++)
+    {
+        __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+        clmul_accumulate(power, h_swapped, low, high);
+        power = clmul_reduce(low, high);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(powers) + k, power);
+    }
+}
+
+/**
+ * Folds nblocks blocks of data into y, GCM_AGGREGATE blocks per reduction
+ * */
+CLMUL_TARGET static void ghash_blocks_clmul(uint8_t const *powers, uint8_t *y, uint8_t const *data, size_t nblocks)
+{
+    __m128i const *h_powers = reinterpret_cast<__m128i const *>(powers);
+    __m128i const *blocks = reinterpret_cast<__m128i const *>(data);
+    __m128i state = clmul_byte_swap(_mm_loadu_si128(reinterpret_cast<__m128i const *>(y)));
+    size_t i = 0;
+    for (; i + GCM_AGGREGATE <= nblocks; i += GCM_AGGREGATE)
+    {
+        __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+        for (int b = 0; b < GCM_AGGREGATE; b++)
+        {
+            __m128i block = clmul_byte_swap(_mm_loadu_si128(blocks + i + b));
+            if (b == 0)
+            {
+                block = _mm_xor_si128(block, state);
+            }
+            clmul_accumulate(block, _mm_loadu_si128(h_powers + GCM_AGGREGATE - 1 - b), low, high);
+        }
+        state = clmul_reduce(low, high);
+    }
+    for (; i < nblocks; i++)
+    {
+        __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+        clmul_accumulate(_mm_xor_si128(state, clmul_byte_swap(_mm_loadu_si128(blocks + i))), _mm_loadu_si128(h_powers), low, high);
+        state = clmul_reduce(low, high);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y), clmul_byte_swap(state));
+}
+
+/**
+ * CTR and GHASH of ngroups groups of GCM_AGGREGATE blocks in one loop. The rounds of a group's
+ * counter blocks are interleaved with the multiplications of the ciphertext hashed next to them:
+ * when decrypting the group's own input, when encrypting the output of the group before (the last
+ * group is hashed after the loop). counter and y are updated
+ * */
+template <int Nr, bool decrypting>
+GCM_TARGET static void gcm_stitched(uint8_t const *schedule, uint8_t const *powers, uint8_t *counter, uint8_t *y, uint8_t const *in,
+                                    uint8_t *out, size_t ngroups)
+{
+    __m128i round_keys[Nr + 1], h_powers[GCM_AGGREGATE];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(schedule) + round);
+    }
+    for (int k = 0; k < GCM_AGGREGATE; k++)
+    {
+        h_powers[k] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(powers) + k);
+    }
+    __m128i const *src = reinterpret_cast<__m128i const *>(in);
+    __m128i *dst = reinterpret_cast<__m128i *>(out);
+
+    // byte swapped, the 32-bit counter is the low lane and wraps like inc32
+    __m128i next_counter = clmul_byte_swap(_mm_loadu_si128(reinterpret_cast<__m128i const *>(counter)));
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    __m128i state = clmul_byte_swap(_mm_loadu_si128(reinterpret_cast<__m128i const *>(y)));
+    // the byte swapped ciphertext that is hashed during the rounds
+    __m128i hashed[GCM_AGGREGATE];
+
+    for (size_t group = 0; group < ngroups; group++)
+    {
+        const bool hashing = decrypting || group > 0;
+        __m128i blocks[GCM_AGGREGATE];
+        for (int b = 0; b < GCM_AGGREGATE; b++)
+        {
+            blocks[b] = _mm_xor_si128(clmul_byte_swap(next_counter), round_keys[0]);
+            next_counter = _mm_add_epi32(next_counter, one);
+            if (decrypting)
+            {
+                hashed[b] = clmul_byte_swap(_mm_loadu_si128(src + GCM_AGGREGATE * group + b));
+            }
+        }
+        if (hashing)
+        {
+            hashed[0] = _mm_xor_si128(hashed[0], state);
+        }
+
+        __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int b = 0; b < GCM_AGGREGATE; b++)
+            {
+                blocks[b] = _mm_aesenc_si128(blocks[b], round_keys[round]);
+            }
+            // Nr is at least 10, one multiplication per round covers the group
+            if (hashing && round <= GCM_AGGREGATE)
+            {
+                clmul_accumulate(hashed[round - 1], h_powers[GCM_AGGREGATE - round], low, high);
+            }
+        }
+        if (hashing)
+        {
+            state = clmul_reduce(low, high);
+        }
+
+        for (int b = 0; b < GCM_AGGREGATE; b++)
+        {
+            const size_t i = GCM_AGGREGATE * group + b;
+            __m128i block = _mm_xor_si128(_mm_aesenclast_si128(blocks[b], round_keys[Nr]), _mm_loadu_si128(src + i));
+            _mm_storeu_si128(dst + i, block);
+            if (!decrypting)
+            {
+                hashed[b] = clmul_byte_swap(block);
+            }
+        }
+    }
+
+    if (!decrypting && ngroups > 0)
+    {
+        __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+        hashed[0] = _mm_xor_si128(hashed[0], state);
+        for (int b = 0; b < GCM_AGGREGATE; b++)
+        {
+            clmul_accumulate(hashed[b], h_powers[GCM_AGGREGATE - 1 - b], low, high);
+        }
+        state = clmul_reduce(low, high);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y), clmul_byte_swap(state));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(counter), clmul_byte_swap(next_counter));
+}
+
+/**
+ * Encrypts ngroups groups of GCM_AGGREGATE blocks and hashes the ciphertext, with the AES-NI schedule
+ * */
+template <int Nk, int Nr = Nk + 6>
+GCM_TARGET void EncryptGroups_GCM(uint8_t const *schedule, uint8_t const *powers, uint8_t *counter, uint8_t *y, uint8_t const *in,
+                                  uint8_t *out, size_t ngroups)
+{
+    gcm_stitched<Nr, false>(schedule, powers, counter, y, in, out, ngroups);
+}
+
+/**
+ * Hashes ngroups groups of GCM_AGGREGATE blocks of ciphertext and decrypts them, with the AES-NI schedule
+ * */
+template <int Nk, int Nr = Nk + 6>
+GCM_TARGET void DecryptGroups_GCM(uint8_t const *schedule, uint8_t const *powers, uint8_t *counter, uint8_t *y, uint8_t const *in,
+                                  uint8_t *out, size_t ngroups)
+{
+    gcm_stitched<Nr, true>(schedule, powers, counter, y, in, out, ngroups);
+}
+
+#endif
+
+typedef void (*GcmGroupsFunction)(uint8_t const *schedule, uint8_t const *powers, uint8_t *counter, uint8_t *y, uint8_t const *in,
+                                  uint8_t *out, size_t ngroups);
+
+/**
+ * GCM with one key. The hash key and its powers are derived once by the constructor, after that
+ * a Gcm is only read, so it can be shared by threads like its Schedule
+ * */
+class Gcm
+{
+public:
+    /**
+     * Derives H = E(0) from schedule, which must outlive the Gcm, and picks the stitched loop if
+     * the backend uses AES-NI and the cpu has PCLMULQDQ
+     * */
+    explicit Gcm(Schedule const &schedule)
+        : schedule(schedule), clmul(false), encrypt_groups(nullptr), decrypt_groups(nullptr)
+    {
+        const uint8_t zero[16] = {};
+        schedule.encrypt_blocks(zero, h, 1);
+#if defined(__x86_64__) || defined(__i386__)
+        clmul = cpu_has_pclmul();
+        if (clmul)
+        {
+            clmul_powers(h, h_powers);
+        }
+        if (clmul && schedule.backend().aesni)
+        {
+            static const GcmGroupsFunction encrypt_functions[KEY_SIZE_COUNT] = FOR_EACH_KEY_SIZE(EncryptGroups_GCM);
+            static const GcmGroupsFunction decrypt_functions[KEY_SIZE_COUNT] = FOR_EACH_KEY_SIZE(DecryptGroups_GCM);
+            encrypt_groups = encrypt_functions[Schedule::function_index(schedule.key_size())];
+            decrypt_groups = decrypt_functions[Schedule::function_index(schedule.key_size())];
+        }
+#endif
+    }
+
+    /**
+     * Encrypts length bytes from in to out with the initialization vector iv of iv_size bytes (12
+     * is the recommended size, any other size is hashed into the counter block), and writes the 16
+     * byte tag over the additional data aad and the ciphertext. out may be equal to in. Returns
+     * false, without touching out, if length is above GCM_MAX_LENGTH
+     * */
+    bool encrypt(uint8_t const *iv, size_t iv_size, uint8_t const *aad, size_t aad_size, uint8_t const *in, uint8_t *out,
+                 size_t length, uint8_t *tag) const
+    {
+        if (length > GCM_MAX_LENGTH)
+        {
+            return false;
+        }
+        crypt(iv, iv_size, aad, aad_size, in, out, length, false, tag);
+        return true;
+    }
+
+    /**
+     * Decrypts length bytes from in to out and checks the 16 byte tag. Returns false, with out
+     * cleared, if the tag does not match, so no plaintext of a forged message is left behind, and
+     * without touching out if length is above GCM_MAX_LENGTH. out may be equal to in
+     * */
+    bool decrypt(uint8_t const *iv, size_t iv_size, uint8_t const *aad, size_t aad_size, uint8_t const *in, uint8_t *out,
+                 size_t length, uint8_t const *tag) const
+    {
+        if (length > GCM_MAX_LENGTH)
+        {
+            return false;
+        }
+        uint8_t computed[16];
+        crypt(iv, iv_size, aad, aad_size, in, out, length, true, computed);
+        // every byte is compared, the time does not tell where the first difference is
+        uint8_t difference = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            difference |= computed[i] ^ tag[i];
+        }
+        if (difference != 0)
+        {
+            std::memset(out, 0, length);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Folds size bytes of data into y, a trailing partial block padded with zero bytes
+     * */
+    void ghash(uint8_t *y, uint8_t const *data, size_t size) const
+    {
+        const size_t nblocks = size / 16;
+        uint8_t last[16] = {};
+        if (size % 16 != 0)
+        {
+            std::memcpy(last, data + 16 * nblocks, size % 16);
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        if (clmul)
+        {
+            ghash_blocks_clmul(h_powers, y, data, nblocks);
+            if (size % 16 != 0)
+            {
+                ghash_blocks_clmul(h_powers, y, last, 1);
+            }
+            return;
+        }
+#endif
+        for (size_t i = 0; i < nblocks; i++)
+        {
+            xor_keystream(data + 16 * i, y, y, 16);
+            ghash_multiply(y, h, y);
+        }
+        if (size % 16 != 0)
+        {
+            xor_keystream(last, y, y, 16);
+            ghash_multiply(y, h, y);
+        }
+    }
+
+private:
+    /**
+     * Both directions: the ciphertext is hashed before it is decrypted or after it is encrypted
+     * */
+    void crypt(uint8_t const *iv, size_t iv_size, uint8_t const *aad, size_t aad_size, uint8_t const *in, uint8_t *out,
+               size_t length, bool decrypting, uint8_t *tag) const
+    {
+        // J0, the counter block of the tag
+        uint8_t j0[16] = {};
+        if (iv_size == 12)
+        {
+            std::memcpy(j0, iv, 12);
+            j0[15] = 1;
+        }
+        else
+        {
+            uint8_t iv_length[16] = {};
+            store_big_endian_64(iv_length + 8, 8 * static_cast<uint64_t>(iv_size));
+            ghash(j0, iv, iv_size);
+            ghash(j0, iv_length, 16);
+        }
+        uint8_t counter[16];
+        std::memcpy(counter, j0, 16);
+        gcm_increment(counter);
+
+        uint8_t y[16] = {};
+        ghash(y, aad, aad_size);
+
+        // whole groups in the stitched loop
+        size_t done = 0;
+        GcmGroupsFunction groups = decrypting ? decrypt_groups : encrypt_groups;
+        const size_t ngroups = length / (16 * GCM_AGGREGATE);
+        if (groups != nullptr && ngroups > 0)
+        {
+            groups(schedule.round_keys(), h_powers, counter, y, in, out, ngroups);
+            done = 16 * GCM_AGGREGATE * ngroups;
+        }
+
+        // the rest, or everything with other backends, a batch of keystream at a time
+        uint8_t counters[16 * GCM_BATCH_BLOCKS], keystream[16 * GCM_BATCH_BLOCKS];
+        while (done < length)
+        {
+            const size_t bytes = length - done < sizeof(keystream) ? length - done : sizeof(keystream);
+            const size_t nblocks = (bytes + 15) / 16;
+            for (size_t b = 0; b < nblocks; b++)
+            {
+                std::memcpy(counters + 16 * b, counter, 16);
+                gcm_increment(counter);
+            }
+            schedule.encrypt_blocks(counters, keystream, nblocks);
+            if (decrypting)
+            {
+                ghash(y, in + done, bytes);
+            }
+            xor_keystream(keystream, in + done, out + done, bytes);
+            if (!decrypting)
+            {
+                ghash(y, out + done, bytes);
+            }
+            done += bytes;
+        }
+
+        uint8_t lengths[16];
+        store_big_endian_64(lengths, 8 * static_cast<uint64_t>(aad_size));
+        store_big_endian_64(lengths + 8, 8 * static_cast<uint64_t>(length));
+        ghash(y, lengths, 16);
+
+        schedule.encrypt_blocks(j0, tag, 1);
+        xor_keystream(y, tag, tag, 16);
+    }
+
+    Schedule const &schedule;
+    // the hash key E(0) in the byte order of the standard
+    uint8_t h[16];
+    // H, H^2 .. H^GCM_AGGREGATE byte swapped, when clmul is set
+    uint8_t h_powers[16 * GCM_AGGREGATE];
+    bool clmul;
+    // the stitched loops for the key size, nullptr if the backend does not use AES-NI
+    GcmGroupsFunction encrypt_groups;
+    GcmGroupsFunction decrypt_groups;
+};
+
+#endif
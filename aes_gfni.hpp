@@ -0,0 +1,322 @@
+#ifndef AES_GFNI_HPP
+#define AES_GFNI_HPP
+
+// GFNI backends.
+//
+// gf2p8affineinvqb inverts every byte in GF(2^8) (modulo 0x11b, the AES polynomial) and applies an
+// affine transform to it, which with the S-box matrix and constant 0x63 is SubBytes on a whole
+// register. gf2p8mulb multiplies bytes in the same field, so xtime is one instruction too.
+// InvSubBytes is gf2p8affineqb with the inverse affine transform, then gf2p8affineinvqb with the
+// identity matrix for the inversion alone.
+// ShiftRows and the MixColumns rotations are byte shuffles like in the vector permute backend.
+// Neither instruction reads memory, so this is constant time, and it is useful on hosts that
+// have GFNI but no AES-NI (or where AES-NI is masked).
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cstring>
+#include <immintrin.h>
+
+#define GFNI_TARGET __attribute__((target("gfni,ssse3")))
+#define GFNI256_TARGET __attribute__((target("gfni,avx2")))
+
+// rows of the S-box affine matrix, in the bit order gf2p8affineinvqb expects
+static const long long GFNI_SBOX_MATRIX = 0xF1E3C78F1F3E7CF8LL;
+// the inverse affine transform (constant 0x05) and the identity, in the same bit order
+static const long long GFNI_INVERSE_AFFINE_MATRIX = static_cast<long long>(0xA44992254A942952ULL);
+static const long long GFNI_IDENTITY_MATRIX = 0x0102040810204080LL;
+
+/**
+ * SubBytes on all 16 bytes
+ * */
+GFNI_TARGET static inline __m128i gfni_sub_bytes(__m128i x)
+{
+    return _mm_gf2p8affineinv_epi64_epi8(x, _mm_set1_epi64x(GFNI_SBOX_MATRIX), 0x63);
+}
+
+GFNI256_TARGET static inline __m256i gfni_sub_bytes(__m256i x)
+{
+    return _mm256_gf2p8affineinv_epi64_epi8(x, _mm256_set1_epi64x(GFNI_SBOX_MATRIX), 0x63);
+}
+
+/**
+ * InvSubBytes on all 16 bytes
+ * */
+GFNI_TARGET static inline __m128i gfni_inv_sub_bytes(__m128i x)
+{
+    x = _mm_gf2p8affine_epi64_epi8(x, _mm_set1_epi64x(GFNI_INVERSE_AFFINE_MATRIX), 0x05);
+    return _mm_gf2p8affineinv_epi64_epi8(x, _mm_set1_epi64x(GFNI_IDENTITY_MATRIX), 0);
+}
+
+GFNI256_TARGET static inline __m256i gfni_inv_sub_bytes(__m256i x)
+{
+    x = _mm256_gf2p8affine_epi64_epi8(x, _mm256_set1_epi64x(GFNI_INVERSE_AFFINE_MATRIX), 0x05);
+    return _mm256_gf2p8affineinv_epi64_epi8(x, _mm256_set1_epi64x(GFNI_IDENTITY_MATRIX), 0);
+}
+
+/**
+ * ShiftRows followed by MixColumns, as 02 * (s ^ r1) ^ r1 ^ r2(s ^ r1) where r1 and r2 rotate every
+ * column up by 1 and 2 rows
+ * */
+GFNI_TARGET static inline __m128i gfni_shift_rows_mix_columns(__m128i x)
+{
+    const __m128i shift_rows = _mm_setr_epi8(0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11);
+    const __m128i rotate_1 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    const __m128i rotate_2 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    x = _mm_shuffle_epi8(x, shift_rows);
+    __m128i rotated = _mm_shuffle_epi8(x, rotate_1);
+    __m128i d = _mm_xor_si128(x, rotated);
+    __m128i twice = _mm_gf2p8mul_epi8(d, _mm_set1_epi8(0x02));
+    return _mm_xor_si128(_mm_xor_si128(twice, rotated), _mm_shuffle_epi8(d, rotate_2));
+}
+
+GFNI256_TARGET static inline __m256i gfni_shift_rows_mix_columns(__m256i x)
+{
+    const __m256i shift_rows = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11));
+    const __m256i rotate_1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12));
+    const __m256i rotate_2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13));
+    x = _mm256_shuffle_epi8(x, shift_rows);
+    __m256i rotated = _mm256_shuffle_epi8(x, rotate_1);
+    __m256i d = _mm256_xor_si256(x, rotated);
+    __m256i twice = _mm256_gf2p8mul_epi8(d, _mm256_set1_epi8(0x02));
+    return _mm256_xor_si256(_mm256_xor_si256(twice, rotated), _mm256_shuffle_epi8(d, rotate_2));
+}
+
+/**
+ * InvShiftRows followed by InvMixColumns, which is MixColumns of s ^ 04 * (s ^ r2) (see InvMixColumn_SWAR)
+ * */
+GFNI_TARGET static inline __m128i gfni_inv_shift_rows_mix_columns(__m128i x)
+{
+    const __m128i inverse_shift_rows = _mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3);
+    const __m128i rotate_1 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    const __m128i rotate_2 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    x = _mm_shuffle_epi8(x, inverse_shift_rows);
+    x = _mm_xor_si128(x, _mm_gf2p8mul_epi8(_mm_xor_si128(x, _mm_shuffle_epi8(x, rotate_2)), _mm_set1_epi8(0x04)));
+    __m128i rotated = _mm_shuffle_epi8(x, rotate_1);
+    __m128i d = _mm_xor_si128(x, rotated);
+    __m128i twice = _mm_gf2p8mul_epi8(d, _mm_set1_epi8(0x02));
+    return _mm_xor_si128(_mm_xor_si128(twice, rotated), _mm_shuffle_epi8(d, rotate_2));
+}
+
+GFNI256_TARGET static inline __m256i gfni_inv_shift_rows_mix_columns(__m256i x)
+{
+    const __m256i inverse_shift_rows = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3));
+    const __m256i rotate_1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12));
+    const __m256i rotate_2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13));
+    x = _mm256_shuffle_epi8(x, inverse_shift_rows);
+    x = _mm256_xor_si256(x, _mm256_gf2p8mul_epi8(_mm256_xor_si256(x, _mm256_shuffle_epi8(x, rotate_2)), _mm256_set1_epi8(0x04)));
+    __m256i rotated = _mm256_shuffle_epi8(x, rotate_1);
+    __m256i d = _mm256_xor_si256(x, rotated);
+    __m256i twice = _mm256_gf2p8mul_epi8(d, _mm256_set1_epi8(0x02));
+    return _mm256_xor_si256(_mm256_xor_si256(twice, rotated), _mm256_shuffle_epi8(d, rotate_2));
+}
+
+/**
+ * Performs Key Expansion with SubWord on gf2p8affineinvqb, so the key schedule is constant time too.
+ * Fills schedule with the same bytes as ExpandKey
+ * */
+template <int Nk, int Nr = Nk + 6>
+GFNI_TARGET void ExpandKey_GFNI(uint8_t const *cipher_key, uint8_t *schedule)
+{
+    static_assert((Nk == 4 || Nk == 6 || Nk == 8) && Nr == Nk + 6, "AES-128, AES-192 or AES-256");
+    std::memcpy(schedule, cipher_key, 4 * Nk);
+    for (int i = Nk; i < Nb * (Nr + 1); i++)
+    {
+        uint8_t temp_word[4];
+        std::memcpy(temp_word, schedule + 4 * (i - 1), 4);
+        if (i % Nk == 0)
+        {
+            // RotWord as a shuffle, then SubWord on the low 4 bytes of the register
+            __m128i word = _mm_setr_epi8(temp_word[1], temp_word[2], temp_word[3], temp_word[0], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+            int substituted = _mm_cvtsi128_si32(gfni_sub_bytes(word));
+            std::memcpy(temp_word, &substituted, 4);
+            temp_word[0] ^= Rcon[(i / Nk) - 1];
+        }
+        else if (Nk > 6 && i % Nk == 4)
+        {
+            // AES-256 substitutes the middle word without rotating it
+            __m128i word = _mm_setr_epi8(temp_word[0], temp_word[1], temp_word[2], temp_word[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+            int substituted = _mm_cvtsi128_si32(gfni_sub_bytes(word));
+            std::memcpy(temp_word, &substituted, 4);
+        }
+        for (int j = 0; j < 4; j++)
+        {
+            schedule[4 * i + j] = schedule[4 * (i - Nk) + j] ^ temp_word[j];
+        }
+    }
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB), one block per xmm register, 4 registers side by side
+ * */
+template <int Nk, int Nr = Nk + 6>
+GFNI_TARGET void EncryptBlocks_GFNI(uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    __m128i round_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(schedule) + round);
+    }
+    const __m128i shift_rows = _mm_setr_epi8(0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11);
+
+    size_t i = 0;
+    while (i < nblocks)
+    {
+        const int group = nblocks - i >= 4 ? 4 : 1;
+        __m128i state[4];
+        for (int b = 0; b < group; b++)
+        {
+            state[b] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(in) + i + b), round_keys[0]);
+        }
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int b = 0; b < group; b++)
+            {
+                state[b] = _mm_xor_si128(gfni_shift_rows_mix_columns(gfni_sub_bytes(state[b])), round_keys[round]);
+            }
+        }
+        for (int b = 0; b < group; b++)
+        {
+            state[b] = _mm_shuffle_epi8(gfni_sub_bytes(state[b]), shift_rows);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out) + i + b, _mm_xor_si128(state[b], round_keys[Nr]));
+        }
+        i += group;
+    }
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB), two blocks per ymm register, 4 registers side by side
+ * */
+template <int Nk, int Nr = Nk + 6>
+GFNI256_TARGET void EncryptBlocks_GFNI256(uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    __m256i round_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const *>(schedule) + round));
+    }
+    const __m256i shift_rows = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11));
+
+    size_t i = 0;
+    for (; i + 8 <= nblocks; i += 8)
+    {
+        __m256i state[4];
+        for (int r = 0; r < 4; r++)
+        {
+            state[r] = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(in + 16 * (i + 2 * r))), round_keys[0]);
+        }
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int r = 0; r < 4; r++)
+            {
+                state[r] = _mm256_xor_si256(gfni_shift_rows_mix_columns(gfni_sub_bytes(state[r])), round_keys[round]);
+            }
+        }
+        for (int r = 0; r < 4; r++)
+        {
+            state[r] = _mm256_shuffle_epi8(gfni_sub_bytes(state[r]), shift_rows);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 16 * (i + 2 * r)), _mm256_xor_si256(state[r], round_keys[Nr]));
+        }
+    }
+
+    EncryptBlocks_GFNI<Nk>(schedule, in + 16 * i, out + 16 * i, nblocks - i);
+}
+
+/**
+ * Decrypts nblocks consecutive blocks (ECB), 4 xmm registers side by side. inverse_schedule is from InvertSchedule
+ * */
+template <int Nk, int Nr = Nk + 6>
+GFNI_TARGET void DecryptBlocks_GFNI(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    __m128i round_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(inverse_schedule) + round);
+    }
+    const __m128i inverse_shift_rows = _mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3);
+
+    size_t i = 0;
+    while (i < nblocks)
+    {
+        const int group = nblocks - i >= 4 ? 4 : 1;
+        __m128i state[4];
+        for (int b = 0; b < group; b++)
+        {
+            state[b] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(in) + i + b), round_keys[0]);
+        }
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int b = 0; b < group; b++)
+            {
+                state[b] = _mm_xor_si128(gfni_inv_shift_rows_mix_columns(gfni_inv_sub_bytes(state[b])), round_keys[round]);
+            }
+        }
+        for (int b = 0; b < group; b++)
+        {
+            state[b] = _mm_shuffle_epi8(gfni_inv_sub_bytes(state[b]), inverse_shift_rows);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out) + i + b, _mm_xor_si128(state[b], round_keys[Nr]));
+        }
+        i += group;
+    }
+}
+
+/**
+ * Decrypts nblocks consecutive blocks (ECB), two blocks per ymm register, 4 registers side by side
+ * */
+template <int Nk, int Nr = Nk + 6>
+GFNI256_TARGET void DecryptBlocks_GFNI256(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    __m256i round_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const *>(inverse_schedule) + round));
+    }
+    const __m256i inverse_shift_rows = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3));
+
+    size_t i = 0;
+    for (; i + 8 <= nblocks; i += 8)
+    {
+        __m256i state[4];
+        for (int r = 0; r < 4; r++)
+        {
+            state[r] = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(in + 16 * (i + 2 * r))), round_keys[0]);
+        }
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int r = 0; r < 4; r++)
+            {
+                state[r] = _mm256_xor_si256(gfni_inv_shift_rows_mix_columns(gfni_inv_sub_bytes(state[r])), round_keys[round]);
+            }
+        }
+        for (int r = 0; r < 4; r++)
+        {
+            state[r] = _mm256_shuffle_epi8(gfni_inv_sub_bytes(state[r]), inverse_shift_rows);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 16 * (i + 2 * r)), _mm256_xor_si256(state[r], round_keys[Nr]));
+        }
+    }
+
+    DecryptBlocks_GFNI<Nk>(inverse_schedule, in + 16 * i, out + 16 * i, nblocks - i);
+}
+
+/**
+ * Multiplies a[i] and b[i] in GF(2^8) for i < n, like multiply_in_GF, 32 bytes per instruction.
+ * Needs GFNI and AVX2, see cpu_has_gfni_avx2
+ * */
+GFNI256_TARGET static inline void multiply_in_GF_GFNI256(uint8_t const *a, uint8_t const *b, uint8_t *product, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(product + i), _mm256_gf2p8mul_epi8(x, y));
+    }
+    for (; i < n; i++)
+    {
+        product[i] = multiply_in_GF(a[i], b[i]);
+    }
+}
+
+#endif
+
+#endif
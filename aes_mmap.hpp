@@ -0,0 +1,273 @@
+#ifndef AES_MMAP_HPP
+#define AES_MMAP_HPP
+
+// Memory-mapped file mode.
+//
+// The input file (the key followed by the plaintext, like on stdin) is mapped read-only and
+// populated up front, and the output file is preallocated with fallocate and mapped writable.
+// The blocks are then encrypted straight from the page cache pages of the input into the pages
+// of the output, with no read, write or copy in between, and the pool workers each fill their
+// own range of the output.
+// Like the streaming mode, a trailing partial block is padded with zero bytes.
+// Decryption works the same way on a key followed by the ciphertext, which must be whole blocks.
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * An open file descriptor and, if size is not 0, a mapping of the whole file. Both are released by the destructor
+ * */
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    ~MappedFile()
+    {
+        if (data != nullptr)
+        {
+            munmap(data, size);
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    /**
+     * Maps path for reading, populating the page tables and telling the kernel to read ahead
+     * */
+    bool open_input(char const *path)
+    {
+        fd = open(path, O_RDONLY);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0)
+        {
+            return fail("cannot open", path);
+        }
+        size = static_cast<size_t>(status.st_size);
+        return map(path, PROT_READ, MAP_PRIVATE | MAP_POPULATE);
+    }
+
+    /**
+     * Creates or truncates path, allocates size bytes for it and maps them for writing. Refuses
+     * when path is the open file input_fd (the same name, a hard link or a symbolic link to it):
+     * truncating it would pull the mapped input away, the in-place mode is for that
+     * */
+    bool open_output(char const *path, size_t output_size, int input_fd)
+    {
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        struct stat output_status, input_status;
+        if (fd < 0 || fstat(fd, &output_status) != 0 || fstat(input_fd, &input_status) != 0)
+        {
+            return fail("cannot create", path);
+        }
+        if (output_status.st_dev == input_status.st_dev && output_status.st_ino == input_status.st_ino)
+        {
+            std::cerr << path << " is the input file, use --in-place to replace a file's contents" << std::endl;
+            return false;
+        }
+        if (ftruncate(fd, 0) != 0)
+        {
+            return fail("cannot truncate", path);
+        }
+        size = output_size;
+        if (size == 0)
+        {
+            return true;
+        }
+        // fallocate reserves the blocks, so running out of space is an error here and not a SIGBUS later.
+        // Some file systems do not support it, ftruncate at least sets the size there
+        if (fallocate(fd, 0, 0, static_cast<off_t>(size)) != 0 &&
+            (errno != EOPNOTSUPP || ftruncate(fd, static_cast<off_t>(size)) != 0))
+        {
+            return fail("cannot allocate", path);
+        }
+        return map(path, PROT_READ | PROT_WRITE, MAP_SHARED);
+    }
+
+    /**
+     * Maps path for reading and writing, first growing it with zero bytes to padded_size(its size, header) if it is shorter
+     * */
+    bool open_in_place(char const *path, size_t (*padded_size)(size_t, size_t), size_t header)
+    {
+        fd = open(path, O_RDWR);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0)
+        {
+            return fail("cannot open", path);
+        }
+        size = padded_size(static_cast<size_t>(status.st_size), header);
+        if (size > static_cast<size_t>(status.st_size) && ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            return fail("cannot extend", path);
+        }
+        return map(path, PROT_READ | PROT_WRITE, MAP_SHARED);
+    }
+
+    int fd = -1;
+    uint8_t *data = nullptr;
+    size_t size = 0;
+
+private:
+    bool map(char const *path, int protection, int flags)
+    {
+        if (size == 0)
+        {
+            return true;
+        }
+        void *mapping = mmap(nullptr, size, protection, flags, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            return fail("cannot map", path);
+        }
+        data = static_cast<uint8_t *>(mapping);
+        madvise(data, size, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    static bool fail(char const *what, char const *path)
+    {
+        std::cerr << what << " " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+};
+
+/**
+ * Encrypts the file in_path (the key of key_size bytes followed by the plaintext) into out_path.
+ * Returns false after printing the reason if a file cannot be opened, mapped or allocated
+ * */
+static bool encrypt_file(char const *in_path, char const *out_path, size_t key_size = KEY_SIZE)
+{
+    MappedFile input;
+    if (!input.open_input(in_path))
+    {
+        return false;
+    }
+    if (input.size < key_size)
+    {
+        std::cerr << in_path << " is too short for a key" << std::endl;
+        return false;
+    }
+    const Schedule schedule(input.data, key_size);
+    uint8_t const *plaintext = input.data + key_size;
+    const size_t plaintext_size = input.size - key_size;
+
+    MappedFile output;
+    if (!output.open_output(out_path, (plaintext_size + 15) / 16 * 16, input.fd))
+    {
+        return false;
+    }
+
+    const size_t whole_blocks = plaintext_size / 16;
+    encrypt_blocks_parallel(schedule, plaintext, output.data, whole_blocks);
+    if (plaintext_size % 16 != 0)
+    {
+        uint8_t last[16] = {};
+        std::memcpy(last, plaintext + 16 * whole_blocks, plaintext_size % 16);
+        encrypt_blocks(schedule, last, output.data + 16 * whole_blocks, 1);
+    }
+    return true;
+}
+
+/**
+ * The size of a file with a key of key_size bytes and a plaintext padded to whole blocks
+ * */
+static size_t padded_file_size(size_t size, size_t key_size)
+{
+    if (size <= key_size)
+    {
+        return size;
+    }
+    return key_size + (size - key_size + 15) / 16 * 16;
+}
+
+/**
+ * Encrypts the plaintext in the file at path (the key of key_size bytes followed by the plaintext) where it lies, in
+ * its page cache pages. The key stays at the start of the file and the plaintext is replaced by
+ * the ciphertext, padded with zero bytes to whole blocks. Returns false after printing the reason
+ * if the file cannot be opened, extended or mapped
+ * */
+static bool encrypt_file_in_place(char const *path, size_t key_size = KEY_SIZE)
+{
+    MappedFile file;
+    if (!file.open_in_place(path, padded_file_size, key_size))
+    {
+        return false;
+    }
+    if (file.size < key_size)
+    {
+        std::cerr << path << " is too short for a key" << std::endl;
+        return false;
+    }
+    const Schedule schedule(file.data, key_size);
+    encrypt_blocks_parallel(schedule, file.data + key_size, file.data + key_size, (file.size - key_size) / 16);
+    return true;
+}
+
+/**
+ * Decrypts the file in_path (the key of key_size bytes followed by the ciphertext) into out_path. The
+ * output is the padded plaintext. Returns false after printing the reason if a file cannot be
+ * opened, mapped or allocated, or the ciphertext is not whole blocks
+ * */
+static bool decrypt_file(char const *in_path, char const *out_path, size_t key_size = KEY_SIZE)
+{
+    MappedFile input;
+    if (!input.open_input(in_path))
+    {
+        return false;
+    }
+    if (input.size < key_size || (input.size - key_size) % 16 != 0)
+    {
+        std::cerr << in_path << " is not a key followed by whole blocks" << std::endl;
+        return false;
+    }
+    const Schedule schedule(input.data, key_size);
+    const size_t ciphertext_size = input.size - key_size;
+
+    MappedFile output;
+    if (!output.open_output(out_path, ciphertext_size, input.fd))
+    {
+        return false;
+    }
+    decrypt_blocks_parallel(schedule, input.data + key_size, output.data, ciphertext_size / 16);
+    return true;
+}
+
+/**
+ * The size of a file that is not padded
+ * */
+static size_t unpadded_file_size(size_t size, size_t)
+{
+    return size;
+}
+
+/**
+ * Decrypts the ciphertext in the file at path (the key of key_size bytes followed by the
+ * ciphertext) where it lies, the inverse of encrypt_file_in_place. Returns false after printing
+ * the reason if the file cannot be opened or mapped, or the ciphertext is not whole blocks
+ * */
+static bool decrypt_file_in_place(char const *path, size_t key_size = KEY_SIZE)
+{
+    MappedFile file;
+    if (!file.open_in_place(path, unpadded_file_size, key_size))
+    {
+        return false;
+    }
+    if (file.size < key_size || (file.size - key_size) % 16 != 0)
+    {
+        std::cerr << path << " is not a key followed by whole blocks" << std::endl;
+        return false;
+    }
+    const Schedule schedule(file.data, key_size);
+    decrypt_blocks_parallel(schedule, file.data + key_size, file.data + key_size, (file.size - key_size) / 16);
+    return true;
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef AES_NI_HPP
+#define AES_NI_HPP
+
+// AES-NI backend.
+//
+// One aesenc instruction performs a whole round (SubBytes, ShiftRows, MixColumns and AddRoundKey)
+// on a 128-bit register. aesenc has a latency of several cycles but can start a new round every
+// cycle, so the block loop keeps AESNI_BLOCKS independent blocks in flight.
+// The 128-bit registers hold the block in input order, which is also the layout of an expanded key.
+// aesdec is a round of the equivalent inverse cipher, so decryption is the same loop with the
+// inverse schedule, which aesimc (InvMixColumns) derives from the expanded key.
+// Every key size has its own instance of the functions, with the round count Nr a constant.
+// Intel's white paper: https://www.intel.com/content/dam/doc/white-paper/advanced-encryption-standard-new-instructions-set-paper.pdf
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cstring>
+#include <wmmintrin.h>
+
+#define AESNI_TARGET __attribute__((target("aes")))
+
+// number of blocks encrypted together, enough to cover the aesenc latency on current cores
+static const int AESNI_BLOCKS = 8;
+
+/**
+ * One step of the key expansion: xor's the previous round key into itself shifted by 1, 2 and 3 words
+ * and adds the rotated, substituted word from aeskeygenassist
+ * */
+AESNI_TARGET static inline __m128i aesni_expand_step(__m128i previous, __m128i assist)
+{
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    previous = _mm_xor_si128(previous, _mm_slli_si128(previous, 4));
+    previous = _mm_xor_si128(previous, _mm_slli_si128(previous, 4));
+    previous = _mm_xor_si128(previous, _mm_slli_si128(previous, 4));
+    return _mm_xor_si128(previous, assist);
+}
+
+/**
+ * aeskeygenassist needs the round constant as an immediate
+ * */
+template <int rcon>
+AESNI_TARGET static inline __m128i aesni_next_round_key(__m128i previous)
+{
+    return aesni_expand_step(previous, _mm_aeskeygenassist_si128(previous, rcon));
+}
+
+/**
+ * SubWord of a key schedule word: aeskeygenassist substitutes word 1 of its input into word 0
+ * */
+AESNI_TARGET static inline uint32_t aesni_sub_word(uint32_t word)
+{
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_aeskeygenassist_si128(_mm_set_epi32(0, 0, static_cast<int>(word), 0), 0)));
+}
+
+/**
+ * AES-128 Key Expansion, a whole round key per step
+ * */
+AESNI_TARGET static void aesni_expand_key_128(uint8_t const *cipher_key, uint8_t *schedule)
+{
+    __m128i *round_keys = reinterpret_cast<__m128i *>(schedule);
+    __m128i k = _mm_loadu_si128(reinterpret_cast<__m128i const *>(cipher_key));
+    _mm_storeu_si128(round_keys, k);
+    k = aesni_next_round_key<0x01>(k);
+    _mm_storeu_si128(round_keys + 1, k);
+    k = aesni_next_round_key<0x02>(k);
+    _mm_storeu_si128(round_keys + 2, k);
+    k = aesni_next_round_key<0x04>(k);
+    _mm_storeu_si128(round_keys + 3, k);
+    k = aesni_next_round_key<0x08>(k);
+    _mm_storeu_si128(round_keys + 4, k);
+    k = aesni_next_round_key<0x10>(k);
+    _mm_storeu_si128(round_keys + 5, k);
+    k = aesni_next_round_key<0x20>(k);
+    _mm_storeu_si128(round_keys + 6, k);
+    k = aesni_next_round_key<0x40>(k);
+    _mm_storeu_si128(round_keys + 7, k);
+    k = aesni_next_round_key<0x80>(k);
+    _mm_storeu_si128(round_keys + 8, k);
+    k = aesni_next_round_key<0x1b>(k);
+    _mm_storeu_si128(round_keys + 9, k);
+    k = aesni_next_round_key<0x36>(k);
+    _mm_storeu_si128(round_keys + 10, k);
+}
+
+/**
+ * Performs Key Expansion with aeskeygenassist. Fills schedule with the same bytes as ExpandKey.
+ * AES-192 and AES-256 round keys do not line up with their Nk word steps, so they are expanded a
+ * word at a time with aeskeygenassist only doing SubWord
+ * */
+template <int Nk, int Nr = Nk + 6>
+AESNI_TARGET void ExpandKey_AESNI(uint8_t const *cipher_key, uint8_t *schedule)
+{
+    static_assert((Nk == 4 || Nk == 6 || Nk == 8) && Nr == Nk + 6, "AES-128, AES-192 or AES-256");
+    if (Nk == 4)
+    {
+        aesni_expand_key_128(cipher_key, schedule);
+        return;
+    }
+    uint32_t words[Nb * (Nr + 1)];
+    std::memcpy(words, cipher_key, 4 * Nk);
+    for (int i = Nk; i < Nb * (Nr + 1); i++)
+    {
+        // the words are in memory order, so byte 0 of the word is the low byte and RotWord is a rotate right
+        uint32_t temp = words[i - 1];
+        if (i % Nk == 0)
+        {
+            temp = aesni_sub_word((temp >> 8) | (temp << 24)) ^ Rcon[(i / Nk) - 1];
+        }
+        else if (Nk > 6 && i % Nk == 4)
+        {
+            temp = aesni_sub_word(temp);
+        }
+        words[i] = words[i - Nk] ^ temp;
+    }
+    std::memcpy(schedule, words, sizeof(words));
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB) with aesenc/aesenclast, AESNI_BLOCKS at a time
+ * */
+template <int Nk, int Nr = Nk + 6>
+AESNI_TARGET void EncryptBlocks_AESNI(uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    __m128i round_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(schedule) + round);
+    }
+
+    __m128i const *src = reinterpret_cast<__m128i const *>(in);
+    __m128i *dst = reinterpret_cast<__m128i *>(out);
+    size_t i = 0;
+
+    for (; i + AESNI_BLOCKS <= nblocks; i += AESNI_BLOCKS)
+    {
+        __m128i state[AESNI_BLOCKS];
+        for (int b = 0; b < AESNI_BLOCKS; b++)
+        {
+            state[b] = _mm_xor_si128(_mm_loadu_si128(src + i + b), round_keys[0]);
+        }
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int b = 0; b < AESNI_BLOCKS; b++)
+            {
+                state[b] = _mm_aesenc_si128(state[b], round_keys[round]);
+            }
+        }
+        for (int b = 0; b < AESNI_BLOCKS; b++)
+        {
+            _mm_storeu_si128(dst + i + b, _mm_aesenclast_si128(state[b], round_keys[Nr]));
+        }
+    }
+
+    // the blocks that do not fill a whole group
+    for (; i < nblocks; i++)
+    {
+        __m128i state = _mm_xor_si128(_mm_loadu_si128(src + i), round_keys[0]);
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            state = _mm_aesenc_si128(state, round_keys[round]);
+        }
+        _mm_storeu_si128(dst + i, _mm_aesenclast_si128(state, round_keys[Nr]));
+    }
+}
+
+/**
+ * Builds the inverse schedule of InvertSchedule with aesimc, which is InvMixColumns on a round key
+ * */
+template <int Nk, int Nr = Nk + 6>
+AESNI_TARGET void InvertSchedule_AESNI(uint8_t const *schedule, uint8_t *inverse_schedule)
+{
+    __m128i const *round_keys = reinterpret_cast<__m128i const *>(schedule);
+    __m128i *inverse_keys = reinterpret_cast<__m128i *>(inverse_schedule);
+    _mm_storeu_si128(inverse_keys, _mm_loadu_si128(round_keys + Nr));
+    for (int round = 1; round < Nr; round++)
+    {
+        _mm_storeu_si128(inverse_keys + round, _mm_aesimc_si128(_mm_loadu_si128(round_keys + Nr - round)));
+    }
+    _mm_storeu_si128(inverse_keys + Nr, _mm_loadu_si128(round_keys));
+}
+
+/**
+ * Decrypts nblocks consecutive blocks (ECB) with aesdec/aesdeclast, AESNI_BLOCKS at a time.
+ * aesdec is a round of the equivalent inverse cipher, so inverse_schedule is from InvertSchedule
+ * */
+template <int Nk, int Nr = Nk + 6>
+AESNI_TARGET void DecryptBlocks_AESNI(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    __m128i round_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(inverse_schedule) + round);
+    }
+
+    __m128i const *src = reinterpret_cast<__m128i const *>(in);
+    __m128i *dst = reinterpret_cast<__m128i *>(out);
+    size_t i = 0;
+
+    for (; i + AESNI_BLOCKS <= nblocks; i += AESNI_BLOCKS)
+    {
+        __m128i state[AESNI_BLOCKS];
+        for (int b = 0; b < AESNI_BLOCKS; b++)
+        {
+            state[b] = _mm_xor_si128(_mm_loadu_si128(src + i + b), round_keys[0]);
+        }
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int b = 0; b < AESNI_BLOCKS; b++)
+            {
+                state[b] = _mm_aesdec_si128(state[b], round_keys[round]);
+            }
+        }
+        for (int b = 0; b < AESNI_BLOCKS; b++)
+        {
+            _mm_storeu_si128(dst + i + b, _mm_aesdeclast_si128(state[b], round_keys[Nr]));
+        }
+    }
+
+    for (; i < nblocks; i++)
+    {
+        __m128i state = _mm_xor_si128(_mm_loadu_si128(src + i), round_keys[0]);
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            state = _mm_aesdec_si128(state, round_keys[round]);
+        }
+        _mm_storeu_si128(dst + i, _mm_aesdeclast_si128(state, round_keys[Nr]));
+    }
+}
+
+#endif
+
+#endif
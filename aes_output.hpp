@@ -0,0 +1,143 @@
+#ifndef AES_OUTPUT_HPP
+#define AES_OUTPUT_HPP
+
+// Bulk binary output.
+//
+// Writing the ciphertext a byte at a time through std::cout goes through the stream, its locale
+// and its formatting for every byte. Output writes whole buffers to a file descriptor with
+// write(2) instead. Small writes are collected in a page aligned buffer, and when a large write
+// comes after buffered bytes both go out in a single writev(2). Partial writes and EINTR are
+// retried, other errors are reported once to std::cerr and make ok() return false.
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * Writes all of the given buffers to fd, retrying partial writes. Returns false on an error
+ * */
+static bool write_all(int fd, struct iovec *buffers, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = count == 1 ? write(fd, buffers[0].iov_base, buffers[0].iov_len) : writev(fd, buffers, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        // skip what was written, possibly part of a buffer
+        size_t left = static_cast<size_t>(written);
+        while (count > 0 && left >= buffers[0].iov_len)
+        {
+            left -= buffers[0].iov_len;
+            buffers++;
+            count--;
+        }
+        if (count > 0)
+        {
+            buffers[0].iov_base = static_cast<uint8_t *>(buffers[0].iov_base) + left;
+            buffers[0].iov_len -= left;
+        }
+    }
+    return true;
+}
+
+class Output
+{
+public:
+    // bytes collected before a write(2), and the size from which writes bypass the buffer
+    static const size_t BUFFER_SIZE = 1 << 16;
+
+    /**
+     * Writes to fd, which stays open when the Output is destroyed
+     * */
+    explicit Output(int fd)
+        : fd(fd)
+    {
+        if (posix_memalign(reinterpret_cast<void **>(&buffer), 4096, BUFFER_SIZE) != 0)
+        {
+            buffer = nullptr;
+            failed = true;
+        }
+    }
+
+    ~Output()
+    {
+        flush();
+        std::free(buffer);
+    }
+
+    Output(Output const &) = delete;
+    Output &operator=(Output const &) = delete;
+
+    /**
+     * Writes size bytes. Large writes go straight to the file descriptor together with what is buffered
+     * */
+    bool write(uint8_t const *data, size_t size)
+    {
+        if (failed)
+        {
+            return false;
+        }
+        if (used + size <= BUFFER_SIZE)
+        {
+            std::memcpy(buffer + used, data, size);
+            used += size;
+            return true;
+        }
+        if (size < BUFFER_SIZE)
+        {
+            return flush() && write(data, size);
+        }
+        struct iovec buffers[2] = {{buffer, used}, {const_cast<uint8_t *>(data), size}};
+        int first = used == 0 ? 1 : 0;
+        used = 0;
+        return check(write_all(fd, buffers + first, 2 - first));
+    }
+
+    /**
+     * Writes out everything that is buffered
+     * */
+    bool flush()
+    {
+        if (failed || used == 0)
+        {
+            return !failed;
+        }
+        struct iovec buffers[1] = {{buffer, used}};
+        used = 0;
+        return check(write_all(fd, buffers, 1));
+    }
+
+    /**
+     * false once a write has failed
+     * */
+    bool ok() const
+    {
+        return !failed;
+    }
+
+private:
+    bool check(bool written)
+    {
+        if (!written)
+        {
+            std::cerr << "write failed: " << std::strerror(errno) << std::endl;
+            failed = true;
+        }
+        return written;
+    }
+
+    int fd;
+    uint8_t *buffer = nullptr;
+    size_t used = 0;
+    bool failed = false;
+};
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef AES_PARALLEL_HPP
+#define AES_PARALLEL_HPP
+
+// Parallel bulk encryption and decryption.
+//
+// ECB blocks are independent, so a large input is cut into chunks that fit in the L2 cache and
+// encrypted by a persistent pool of worker threads together with the calling thread. Every chunk
+// is written straight to its place in the output, so the result is in order without any copying.
+//
+// Work stealing: each thread starts with an equal, contiguous range of chunks and takes chunks
+// from the front of it. A thread that runs out steals the back half of another thread's range,
+// so a thread that is descheduled or slowed down does not hold up the rest. A range is one
+// 64-bit atomic (begin, end) updated with compare and swap, so there are no locks on this path.
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    /**
+     * Starts the given number of worker threads. The thread calling parallel_for also works, so 0 runs everything inline
+     * */
+    explicit ThreadPool(unsigned workers)
+        : ranges(new Range[workers + 1])
+    {
+        for (unsigned i = 0; i < workers; i++)
+        {
+            threads.emplace_back(&ThreadPool::work, this, i + 1);
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        delete[] ranges;
+    }
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool &operator=(ThreadPool const &) = delete;
+
+    /**
+     * Threads that take part in parallel_for, the workers and the caller
+     * */
+    unsigned size() const
+    {
+        return static_cast<unsigned>(threads.size()) + 1;
+    }
+
+    /**
+     * Calls body(i) for every i < count, spread over the pool, and returns when all calls are done.
+     * Calls from several threads are run one after the other
+     * */
+    template <typename Body>
+    void parallel_for(size_t count, Body const &body)
+    {
+        if (threads.empty() || count <= 1)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                body(i);
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> serialize(job_mutex);
+        const uint64_t participants = size();
+        for (uint64_t p = 0; p < participants; p++)
+        {
+            ranges[p].chunks.store(pack(count * p / participants, count * (p + 1) / participants), std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &call<Body>;
+            job_body = &body;
+            running = static_cast<unsigned>(threads.size());
+            generation++;
+        }
+        wake.notify_all();
+
+        run_chunks(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return running == 0; });
+    }
+
+    /**
+     * The pool shared by the whole process, one thread per core. AES_THREADS sets the number of threads instead
+     * */
+    static ThreadPool &shared()
+    {
+        static ThreadPool pool(default_workers());
+        return pool;
+    }
+
+private:
+    struct Range
+    {
+        // begin in the low 32 bits, end in the high 32 bits
+        std::atomic<uint64_t> chunks{0};
+        // 64 bytes apart, no two ranges share a cache line. Padded rather than aligned, the ranges
+        // are allocated with new and C++14 new does not honour extended alignment
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+    static_assert(sizeof(Range) == 64, "a range fills one cache line");
+
+    static uint64_t pack(uint64_t begin, uint64_t end)
+    {
+        return begin | (end << 32);
+    }
+
+    template <typename Body>
+    static void call(void const *body, size_t i)
+    {
+        (*static_cast<Body const *>(body))(i);
+    }
+
+    static unsigned default_workers()
+    {
+        char const *threads = std::getenv("AES_THREADS");
+        long count = threads != nullptr ? std::atol(threads) : static_cast<long>(std::thread::hardware_concurrency());
+        return count > 1 ? static_cast<unsigned>(count - 1) : 0;
+    }
+
+    /**
+     * Takes the first chunk of the given range, false if it is empty
+     * */
+    bool take(Range &range, size_t &chunk)
+    {
+        uint64_t chunks = range.chunks.load(std::memory_order_relaxed);
+        while (true)
+        {
+            uint64_t begin = chunks & 0xffffffff, end = chunks >> 32;
+            if (begin >= end)
+            {
+                return false;
+            }
+            if (range.chunks.compare_exchange_weak(chunks, pack(begin + 1, end), std::memory_order_relaxed))
+            {
+                chunk = begin;
+                return true;
+            }
+        }
+    }
+
+    /**
+     * Moves the back half of another thread's range into the (empty) range of self, false if there was nothing left
+     * */
+    bool steal(unsigned self)
+    {
+        for (unsigned offset = 1; offset < size(); offset++)
+        {
+            Range &victim = ranges[(self + offset) % size()];
+            uint64_t chunks = victim.chunks.load(std::memory_order_relaxed);
+            while (true)
+            {
+                uint64_t begin = chunks & 0xffffffff, end = chunks >> 32;
+                if (begin >= end)
+                {
+                    break;
+                }
+                uint64_t half = (end - begin + 1) / 2;
+                if (victim.chunks.compare_exchange_weak(chunks, pack(begin, end - half), std::memory_order_relaxed))
+                {
+                    ranges[self].chunks.store(pack(end - half, end), std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void run_chunks(unsigned self)
+    {
+        size_t chunk;
+        do
+        {
+            while (take(ranges[self], chunk))
+            {
+                job(job_body, chunk);
+            }
+        } while (steal(self));
+    }
+
+    void work(unsigned self)
+    {
+        uint64_t seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                {
+                    return;
+                }
+                seen = generation;
+            }
+
+            run_chunks(self);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--running == 0)
+            {
+                done.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> threads;
+    Range *ranges;
+
+    // the current job, set under mutex
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    void (*job)(void const *, size_t) = nullptr;
+    void const *job_body = nullptr;
+    uint64_t generation = 0;
+    unsigned running = 0;
+    bool stopping = false;
+
+    std::mutex job_mutex;
+};
+
+/**
+ * The pool argument of the parallel functions: the pool passed in, or by default the shared one,
+ * which is only looked up (and its threads started) by get(), after an input turned out large
+ * enough to use it
+ * */
+class LazyPool
+{
+public:
+    LazyPool()
+        : given(nullptr)
+    {
+    }
+
+    LazyPool(ThreadPool &pool)
+        : given(&pool)
+    {
+    }
+
+    ThreadPool &get() const
+    {
+        return given != nullptr ? *given : ThreadPool::shared();
+    }
+
+private:
+    ThreadPool *given;
+};
+
+// blocks per chunk, 64 KB of input and 64 KB of output stay in L2
+static const size_t PARALLEL_CHUNK_BLOCKS = 4096;
+// below this many blocks (1 MB) starting the workers costs more than it saves
+static const size_t PARALLEL_MIN_BLOCKS = 16 * PARALLEL_CHUNK_BLOCKS;
+
+/**
+ * Runs blocks (encrypt_blocks or decrypt_blocks) on nblocks consecutive blocks, a chunk per call on all threads of the pool
+ * */
+template <void (*blocks)(Schedule const &, uint8_t const *, uint8_t *, size_t)>
+static void blocks_parallel(Schedule const &schedule, uint8_t const *in, uint8_t *out, size_t nblocks, LazyPool pool)
+{
+    if (nblocks < PARALLEL_MIN_BLOCKS || pool.get().size() == 1)
+    {
+        blocks(schedule, in, out, nblocks);
+        return;
+    }
+    const size_t chunks = (nblocks + PARALLEL_CHUNK_BLOCKS - 1) / PARALLEL_CHUNK_BLOCKS;
+    pool.get().parallel_for(chunks, [&](size_t chunk) {
+        size_t first = chunk * PARALLEL_CHUNK_BLOCKS;
+        size_t count = nblocks - first < PARALLEL_CHUNK_BLOCKS ? nblocks - first : PARALLEL_CHUNK_BLOCKS;
+        blocks(schedule, in + 16 * first, out + 16 * first, count);
+    });
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB) like encrypt_blocks, on all threads of the pool.
+ * Small inputs are encrypted on the calling thread. out may be equal to in, the chunks do not overlap
+ * */
+static void encrypt_blocks_parallel(Schedule const &schedule, uint8_t const *in, uint8_t *out, size_t nblocks, LazyPool pool = LazyPool())
+{
+    blocks_parallel<encrypt_blocks>(schedule, in, out, nblocks, pool);
+}
+
+/**
+ * Decrypts nblocks consecutive blocks (ECB) like decrypt_blocks, on all threads of the pool
+ * */
+static void decrypt_blocks_parallel(Schedule const &schedule, uint8_t const *in, uint8_t *out, size_t nblocks, LazyPool pool = LazyPool())
+{
+    blocks_parallel<decrypt_blocks>(schedule, in, out, nblocks, pool);
+}
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef AES_PIPELINE_HPP
+#define AES_PIPELINE_HPP
+
+// Reader / cipher workers / writer pipeline.
+//
+// The streaming mode reads a chunk, encrypts it and writes it, one after the other. Here a reader
+// thread, N cipher workers and a writer thread run at the same time, so reading and writing
+// overlap with encryption and the throughput tends to the slowest stage instead of the sum.
+//
+//   reader --(one SPSC ring per worker)--> workers --(MPSC ring)--> writer --(SPSC ring)--> reader
+//
+// A fixed set of page aligned chunks is recycled around the loop, which is the backpressure: when
+// the writer falls behind, the reader runs out of free chunks and waits. The number of workers is
+// capped, so the chunks stay within 32 MB on any machine. Workers may finish out of order, so the
+// writer keeps a reorder buffer indexed by sequence number and writes chunks strictly in input
+// order. The rings are lock-free; a thread with nothing to do backs off from spinning to yielding
+// to short sleeps.
+// Like the streaming mode, a trailing partial block is padded with zero bytes.
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * Waits a little longer each time it is called while there is nothing to do
+ * */
+static void backoff(unsigned &idle)
+{
+    idle++;
+    if (idle < 64)
+    {
+        return;
+    }
+    if (idle < 128)
+    {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+/**
+ * Bounded single producer, single consumer ring. capacity must be a power of 2
+ * */
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity)
+        : slots(capacity), mask(capacity - 1)
+    {
+    }
+
+    bool try_push(T const &value)
+    {
+        size_t tail = write_index.load(std::memory_order_relaxed);
+        if (tail - read_index.load(std::memory_order_acquire) == slots.size())
+        {
+            return false;
+        }
+        slots[tail & mask] = value;
+        write_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &value)
+    {
+        size_t head = read_index.load(std::memory_order_relaxed);
+        if (head == write_index.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        value = slots[head & mask];
+        read_index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // on their own cache lines, each is written by one side only. Padded rather than aligned, the
+    // rings are allocated with new and C++14 new does not honour extended alignment
+    char before_write_index[64];
+    std::atomic<size_t> write_index{0};
+    char before_read_index[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> read_index{0};
+    char after_read_index[64 - sizeof(std::atomic<size_t>)];
+};
+
+/**
+ * Bounded multiple producer, single consumer ring. Every slot has a sequence number that tells
+ * whose turn it is, as in Vyukov's bounded queue. capacity must be a power of 2
+ * */
+template <typename T>
+class MpscRing
+{
+public:
+    explicit MpscRing(size_t capacity)
+        : slots(capacity), mask(capacity - 1)
+    {
+        for (size_t i = 0; i < capacity; i++)
+        {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool try_push(T const &value)
+    {
+        size_t position = write_index.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot &slot = slots[position & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == position)
+            {
+                // the slot is free, claim it
+                if (write_index.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    slot.value = value;
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (sequence < position)
+            {
+                // the consumer has not emptied it yet, the ring is full
+                return false;
+            }
+            else
+            {
+                position = write_index.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T &value)
+    {
+        Slot &slot = slots[read_index & mask];
+        if (slot.sequence.load(std::memory_order_acquire) != read_index + 1)
+        {
+            return false;
+        }
+        value = slot.value;
+        slot.sequence.store(read_index + slots.size(), std::memory_order_release);
+        read_index++;
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> write_index{0};
+    // only the consumer uses it
+    alignas(64) size_t read_index = 0;
+};
+
+/**
+ * Reads up to size bytes from fd, fewer only at the end of the input. Returns the number of bytes read, or -1 on an error
+ * */
+static ssize_t read_fully(int fd, uint8_t *buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t got = read(fd, buffer + done, size - done);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (got == 0)
+        {
+            break;
+        }
+        done += static_cast<size_t>(got);
+    }
+    return static_cast<ssize_t>(done);
+}
+
+class Pipeline
+{
+public:
+    // bytes per chunk, a multiple of 16
+    static const size_t CHUNK_SIZE = 1 << 20;
+    // at most 2 * 15 + 2 = 32 chunks, so the pipeline holds 32 MB however many cores there are
+    static const unsigned MAX_WORKERS = 15;
+
+    /**
+     * Sets up the chunks and rings for the given number of cipher workers (at least 1, at most MAX_WORKERS)
+     * */
+    Pipeline(Schedule const &schedule, unsigned workers)
+        : schedule(schedule), worker_count(workers == 0 ? 1 : workers < MAX_WORKERS ? workers : MAX_WORKERS),
+          // two chunks per worker keep every worker busy while the reader and writer hold one each
+          chunk_count(round_up_to_power_of_2(2 * worker_count + 2)),
+          chunks(chunk_count), free_chunks(chunk_count), encrypted(chunk_count), reorder(chunk_count, NONE)
+    {
+        for (unsigned w = 0; w < worker_count; w++)
+        {
+            work.push_back(std::make_unique<SpscRing<size_t>>(chunk_count));
+        }
+        for (size_t c = 0; c < chunk_count; c++)
+        {
+            if (posix_memalign(reinterpret_cast<void **>(&chunks[c].data), 4096, CHUNK_SIZE) != 0)
+            {
+                chunks[c].data = nullptr;
+                failed = true;
+            }
+            free_chunks.try_push(c);
+        }
+    }
+
+    ~Pipeline()
+    {
+        for (Chunk &chunk : chunks)
+        {
+            std::free(chunk.data);
+        }
+    }
+
+    Pipeline(Pipeline const &) = delete;
+    Pipeline &operator=(Pipeline const &) = delete;
+
+    /**
+     * Encrypts everything from in_fd until the end of the input and writes the ciphertext to out_fd.
+     * Returns false if reading or writing failed
+     * */
+    bool run(int in_fd, int out_fd)
+    {
+        if (failed)
+        {
+            return false;
+        }
+        std::thread reader(&Pipeline::read_chunks, this, in_fd);
+        std::vector<std::thread> cipher_workers;
+        for (unsigned w = 0; w < worker_count; w++)
+        {
+            cipher_workers.emplace_back(&Pipeline::encrypt_chunks, this, w);
+        }
+        write_chunks(out_fd);
+        reader.join();
+        for (std::thread &worker : cipher_workers)
+        {
+            worker.join();
+        }
+        return !failed;
+    }
+
+private:
+    struct Chunk
+    {
+        uint8_t *data = nullptr;
+        size_t size = 0;
+        uint64_t sequence = 0;
+        // the end of the input, nothing follows this chunk
+        bool last = false;
+    };
+
+    // a worker stops when it pops this instead of a chunk
+    static const size_t STOP = ~static_cast<size_t>(0);
+    static const size_t NONE = ~static_cast<size_t>(0);
+
+    static size_t round_up_to_power_of_2(size_t n)
+    {
+        size_t power = 1;
+        while (power < n)
+        {
+            power *= 2;
+        }
+        return power;
+    }
+
+    /**
+     * Reader thread: fills free chunks and hands them to the workers in turn
+     * */
+    void read_chunks(int fd)
+    {
+        uint64_t sequence = 0;
+        bool last = false;
+        while (!last)
+        {
+            size_t c;
+            unsigned idle = 0;
+            while (!free_chunks.try_pop(c))
+            {
+                backoff(idle);
+            }
+            Chunk &chunk = chunks[c];
+            ssize_t size = failed ? 0 : read_fully(fd, chunk.data, CHUNK_SIZE);
+            if (size < 0)
+            {
+                report("read failed");
+                size = 0;
+            }
+            chunk.size = static_cast<size_t>(size);
+            chunk.sequence = sequence++;
+            chunk.last = last = chunk.size < CHUNK_SIZE;
+            if (chunk.size % 16 != 0)
+            {
+                std::memset(chunk.data + chunk.size, 0, 16 - chunk.size % 16);
+                chunk.size += 16 - chunk.size % 16;
+            }
+            push_work(c, chunk.sequence);
+        }
+        for (unsigned w = 0; w < worker_count; w++)
+        {
+            unsigned idle = 0;
+            while (!work[w]->try_push(STOP))
+            {
+                backoff(idle);
+            }
+        }
+    }
+
+    /**
+     * Starts with the worker whose turn it is, and takes the next one if its ring is full
+     * */
+    void push_work(size_t c, uint64_t sequence)
+    {
+        unsigned idle = 0;
+        for (unsigned w = sequence % worker_count;; w = (w + 1) % worker_count)
+        {
+            if (work[w]->try_push(c))
+            {
+                return;
+            }
+            backoff(idle);
+        }
+    }
+
+    /**
+     * Cipher worker: encrypts the chunks from its ring in place and passes them to the writer
+     * */
+    void encrypt_chunks(unsigned w)
+    {
+        while (true)
+        {
+            size_t c;
+            unsigned idle = 0;
+            while (!work[w]->try_pop(c))
+            {
+                backoff(idle);
+            }
+            if (c == STOP)
+            {
+                return;
+            }
+            encrypt_blocks_in_place(schedule, chunks[c].data, chunks[c].size / 16);
+            idle = 0;
+            while (!encrypted.try_push(c))
+            {
+                backoff(idle);
+            }
+        }
+    }
+
+    /**
+     * Writer (the calling thread): puts encrypted chunks back in input order, writes them and recycles them
+     * */
+    void write_chunks(int fd)
+    {
+        uint64_t next = 0;
+        bool done = false;
+        while (!done)
+        {
+            size_t c;
+            unsigned idle = 0;
+            while (!encrypted.try_pop(c))
+            {
+                backoff(idle);
+            }
+            // at most chunk_count chunks are in flight, so sequence numbers never collide here
+            reorder[chunks[c].sequence % chunk_count] = c;
+
+            while (reorder[next % chunk_count] != NONE)
+            {
+                size_t ready = reorder[next % chunk_count];
+                reorder[next % chunk_count] = NONE;
+                next++;
+                struct iovec buffer = {chunks[ready].data, chunks[ready].size};
+                if (!failed && !write_all(fd, &buffer, 1))
+                {
+                    report("write failed");
+                }
+                done = chunks[ready].last;
+                free_chunks.try_push(ready);
+            }
+        }
+    }
+
+    void report(char const *what)
+    {
+        if (!failed.exchange(true))
+        {
+            std::cerr << what << ": " << std::strerror(errno) << std::endl;
+        }
+    }
+
+    Schedule const &schedule;
+    const unsigned worker_count;
+    const size_t chunk_count;
+    std::vector<Chunk> chunks;
+    SpscRing<size_t> free_chunks;
+    std::vector<std::unique_ptr<SpscRing<size_t>>> work;
+    MpscRing<size_t> encrypted;
+    std::vector<size_t> reorder;
+    std::atomic<bool> failed{false};
+};
+
+/**
+ * Encrypts everything from in_fd to out_fd with a reader thread, the given number of cipher threads
+ * and the calling thread as the writer. Returns false after printing the reason if reading or writing failed
+ * */
+static bool encrypt_pipeline(Schedule const &schedule, int in_fd, int out_fd, unsigned workers)
+{
+    Pipeline pipeline(schedule, workers);
+    return pipeline.run(in_fd, out_fd);
+}
+
+#endif
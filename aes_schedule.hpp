@@ -0,0 +1,139 @@
+#ifndef AES_SCHEDULE_HPP
+#define AES_SCHEDULE_HPP
+
+// The expanded key object.
+//
+// A Schedule is an expanded key together with the backend it was expanded for. The key size is
+// settled here too: the Schedule keeps the backend's block function for its key size, so
+// encrypting never looks at the key size again. The inverse schedule for decryption is computed
+// next to the expanded key, so it is there for every decryption with the key. It is filled in
+// once by the constructor and only read after that, so one Schedule can be shared by any number
+// of threads, and threads with different keys each use their own without any locking. It is
+// aligned to and padded to whole cache lines, so two Schedules never share a line (no false
+// sharing between threads).
+// Encrypting or decrypting from it only touches the Schedule and the caller's buffers, there are no heap
+// allocations on this path (checked by the "Zero allocations" test).
+
+class alignas(64) Schedule
+{
+public:
+    /**
+     * Expands cipher_key (KEY_SIZE bytes, AES-128) for the given backend, by default the one SelectBackend picks
+     * */
+    explicit Schedule(uint8_t const *cipher_key, Backend const &backend = SelectBackend())
+        : Schedule(cipher_key, KEY_SIZE, backend)
+    {
+    }
+
+    /**
+     * Expands cipher_key of key_size bytes, which must be one of KEY_SIZES (16, 24 or 32 for
+     * AES-128, AES-192 and AES-256), for the given backend, and inverts it for decryption
+     * */
+    Schedule(uint8_t const *cipher_key, size_t key_size, Backend const &backend = SelectBackend())
+        : expanded_for(&backend), size(key_size), encrypt(backend.encrypt_blocks[function_index(key_size)]),
+          decrypt(backend.decrypt_blocks[function_index(key_size)])
+    {
+        backend.expand_key[function_index(key_size)](cipher_key, keys);
+        backend.invert_schedule[function_index(key_size)](keys, inverse_keys);
+    }
+
+    /**
+     * The round keys one after the other, in the layout of ExpandKey
+     * */
+    uint8_t const *round_keys() const
+    {
+        return keys;
+    }
+
+    /**
+     * The round keys of the equivalent inverse cipher, in the layout of InvertSchedule
+     * */
+    uint8_t const *inverse_round_keys() const
+    {
+        return inverse_keys;
+    }
+
+    Backend const &backend() const
+    {
+        return *expanded_for;
+    }
+
+    /**
+     * The size of the cipher key in bytes
+     * */
+    size_t key_size() const
+    {
+        return size;
+    }
+
+    /**
+     * Encrypts nblocks blocks with the backend's function for this key size
+     * */
+    void encrypt_blocks(uint8_t const *in, uint8_t *out, size_t nblocks) const
+    {
+        encrypt(keys, in, out, nblocks);
+    }
+
+    /**
+     * Decrypts nblocks blocks with the backend's function for this key size
+     * */
+    void decrypt_blocks(uint8_t const *in, uint8_t *out, size_t nblocks) const
+    {
+        decrypt(inverse_keys, in, out, nblocks);
+    }
+
+    /**
+     * key_size_index for a valid key size: 16, 24 and 32 bytes are 0, 1 and 2
+     * */
+    static size_t function_index(size_t key_size)
+    {
+        return key_size / 8 - 2;
+    }
+
+private:
+
+    // room for the largest key size
+    uint8_t keys[4 * Nb * (MAX_Nr + 1)];
+    uint8_t inverse_keys[4 * Nb * (MAX_Nr + 1)];
+    Backend const *expanded_for;
+    size_t size;
+    EncryptBlocksFunction encrypt;
+    DecryptBlocksFunction decrypt;
+};
+
+static_assert(sizeof(Schedule) % 64 == 0, "a Schedule fills whole cache lines");
+
+/**
+ * Encrypts nblocks consecutive 16 byte blocks from in to out (ECB). out may be equal to in, every
+ * backend reads a group of blocks before it writes them
+ * */
+static void encrypt_blocks(Schedule const &schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    schedule.encrypt_blocks(in, out, nblocks);
+}
+
+/**
+ * Encrypts nblocks consecutive 16 byte blocks where they lie, the ciphertext replaces the plaintext
+ * */
+static void encrypt_blocks_in_place(Schedule const &schedule, uint8_t *data, size_t nblocks)
+{
+    encrypt_blocks(schedule, data, data, nblocks);
+}
+
+/**
+ * Decrypts nblocks consecutive 16 byte blocks from in to out (ECB), the inverse of encrypt_blocks. out may be equal to in
+ * */
+static void decrypt_blocks(Schedule const &schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    schedule.decrypt_blocks(in, out, nblocks);
+}
+
+/**
+ * Decrypts nblocks consecutive 16 byte blocks where they lie, the plaintext replaces the ciphertext
+ * */
+static inline void decrypt_blocks_in_place(Schedule const &schedule, uint8_t *data, size_t nblocks)
+{
+    decrypt_blocks(schedule, data, data, nblocks);
+}
+
+#endif
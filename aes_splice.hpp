@@ -0,0 +1,154 @@
+#ifndef AES_SPLICE_HPP
+#define AES_SPLICE_HPP
+
+// Zero-copy output to a pipe.
+//
+// write(2) copies the ciphertext into the pipe's own pages. When stdout is a pipe, the streaming
+// mode hands its pages to the pipe with vmsplice(2) and SPLICE_F_GIFT instead, and the reader of
+// the pipe gets them without that copy. The pipe then refers to the pages of our buffer until the
+// reader has consumed them, so they must not be overwritten before that: there are two buffers,
+// each at least as large as the pipe, and the next chunk is encrypted into one buffer only after
+// the whole other one has been spliced. A full buffer fills every slot of the pipe, so by then no
+// page of the first buffer can be left in it. The last one or two chunks are still in the pipe when
+// the input ends, so the buffers are only freed once the reader has drained the pipe.
+// This holds for a reader that read(2)s the pipe. A reader that splice(2)s or tee(2)s the pages
+// on keeps referring to them after they left the pipe, and may see the next chunks in them: feed
+// such consumers from a file, or through a pipe in between that is read with read(2).
+// Where vmsplice is not supported, plain write(2) is used.
+// Like the streaming mode, a trailing partial block is padded with zero bytes.
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// the pipe size asked for, larger pipes need fewer wake ups of the reader (1 MB is the default limit for users)
+static const int SPLICE_PIPE_SIZE = 1 << 20;
+
+/**
+ * true if fd is a pipe (or a FIFO)
+ * */
+static bool is_pipe(int fd)
+{
+    struct stat status;
+    return fstat(fd, &status) == 0 && S_ISFIFO(status.st_mode);
+}
+
+/**
+ * Gifts all of buffer to the pipe fd, retrying partial splices. Returns false on an error, buffer is then what is left
+ * */
+static bool vmsplice_all(int fd, struct iovec &buffer)
+{
+    while (buffer.iov_len > 0)
+    {
+        ssize_t spliced = vmsplice(fd, &buffer, 1, SPLICE_F_GIFT);
+        if (spliced < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        buffer.iov_base = static_cast<uint8_t *>(buffer.iov_base) + spliced;
+        buffer.iov_len -= static_cast<size_t>(spliced);
+    }
+    return true;
+}
+
+/**
+ * Waits until the reader has taken every byte out of the pipe fd, so no gifted page is left in it,
+ * or until there is no reader any more. Polls the fill level every millisecond, the pipe has no
+ * event for becoming empty
+ * */
+static void wait_until_drained(int fd)
+{
+    struct pollfd reader = {fd, 0, 0};
+    int unread = 0;
+    while (ioctl(fd, FIONREAD, &unread) == 0 && unread > 0)
+    {
+        // with no events asked for, poll only returns early for POLLERR, the read end being closed
+        if (poll(&reader, 1, 1) > 0 && (reader.revents & POLLERR) != 0)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * Encrypts everything from in_fd until the end of the input and writes the ciphertext to the
+ * pipe pipe_fd, splicing the pages of two alternating buffers into it. Returns false after
+ * printing the reason if reading or writing failed
+ * */
+static bool encrypt_stream_to_pipe(Schedule const &schedule, int in_fd, int pipe_fd)
+{
+    fcntl(pipe_fd, F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    int pipe_size = fcntl(pipe_fd, F_GETPIPE_SZ);
+    size_t buffer_size = STREAM_CHUNK_SIZE;
+    if (pipe_size > 0 && static_cast<size_t>(pipe_size) > buffer_size)
+    {
+        buffer_size = (static_cast<size_t>(pipe_size) + 4095) / 4096 * 4096;
+    }
+    uint8_t *buffers = nullptr;
+    if (posix_memalign(reinterpret_cast<void **>(&buffers), 4096, 2 * buffer_size) != 0)
+    {
+        std::cerr << "out of memory" << std::endl;
+        return false;
+    }
+
+    bool splice = true, spliced = false, ok = true;
+    for (unsigned turn = 0; ok; turn ^= 1)
+    {
+        uint8_t *buffer = buffers + turn * buffer_size;
+        ssize_t size = read_fully(in_fd, buffer, buffer_size);
+        if (size < 0)
+        {
+            std::cerr << "read failed: " << std::strerror(errno) << std::endl;
+            ok = false;
+            break;
+        }
+        size_t length = static_cast<size_t>(size);
+        if (length % 16 != 0)
+        {
+            std::memset(buffer + length, 0, 16 - length % 16);
+            length += 16 - length % 16;
+        }
+        encrypt_blocks_parallel(schedule, buffer, buffer, length / 16);
+
+        struct iovec rest = {buffer, length};
+        spliced = spliced || splice;
+        if (splice && !vmsplice_all(pipe_fd, rest))
+        {
+            // from here on the rest is written
+            splice = false;
+            if (errno != EINVAL && errno != ENOSYS)
+            {
+                std::cerr << "vmsplice failed: " << std::strerror(errno) << std::endl;
+                ok = false;
+                break;
+            }
+        }
+        if (!splice && !write_all(pipe_fd, &rest, 1))
+        {
+            std::cerr << "write failed: " << std::strerror(errno) << std::endl;
+            ok = false;
+        }
+        if (static_cast<size_t>(size) < buffer_size)
+        {
+            break;
+        }
+    }
+    if (spliced)
+    {
+        wait_until_drained(pipe_fd);
+    }
+    std::free(buffers);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef AES_STREAM_HPP
+#define AES_STREAM_HPP
+
+// Streaming encryption.
+//
+// Reads the plaintext in fixed-size chunks, encrypts each chunk and writes it out before reading
+// the next, so memory use is the same for 16 bytes and for many GB. Lengths are 64-bit.
+// ECB only works on whole blocks, so a trailing partial block is padded with zero bytes and
+// encrypted as a whole block: the output is the input length rounded up to a multiple of 16.
+
+#include <algorithm>
+#include <istream>
+#include <vector>
+
+// bytes per chunk, a multiple of 16. Large enough for encrypt_blocks_parallel to use the pool
+static const size_t STREAM_CHUNK_SIZE = 1 << 20;
+
+/**
+ * Reads up to size bytes, fewer only at the end of the input. Returns the number of bytes read
+ * */
+static size_t read_fully(std::istream &in, uint8_t *buffer, size_t size)
+{
+    in.read(reinterpret_cast<char *>(buffer), size);
+    return static_cast<size_t>(in.gcount());
+}
+
+/**
+ * Encrypts everything from in until the end of the input and writes the ciphertext to out.
+ * Returns the number of plaintext bytes read
+ * */
+static uint64_t encrypt_stream(Schedule const &schedule, std::istream &in, Output &out)
+{
+    // one buffer, every chunk is encrypted in place
+    std::vector<uint8_t> chunk(STREAM_CHUNK_SIZE);
+    uint64_t total = 0;
+    while (true)
+    {
+        size_t size = read_fully(in, chunk.data(), STREAM_CHUNK_SIZE);
+        total += size;
+        if (size % 16 != 0)
+        {
+            std::fill(chunk.begin() + size, chunk.begin() + (size + 15) / 16 * 16, 0);
+            size = (size + 15) / 16 * 16;
+        }
+        encrypt_blocks_parallel(schedule, chunk.data(), chunk.data(), size / 16);
+        if (!out.write(chunk.data(), size))
+        {
+            break;
+        }
+        if (size < STREAM_CHUNK_SIZE)
+        {
+            break;
+        }
+    }
+    out.flush();
+    return total;
+}
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef AES_TABLES_HPP
+#define AES_TABLES_HPP
+
+// Lookup tables, generated at compile time from the field definition.
+//
+// Every table is computed by constexpr code from multiply_in_GF, so they all come from one source
+// and end up as constants in read-only memory. Each table starts on a cache line (64 bytes).
+
+/**
+ * Multiplies a and b in Galois field GF(2^8).
+ * Based on pseudocode from https://en.wikipedia.org/wiki/Finite_field_arithmetic#Multiplication
+ * */
+constexpr uint8_t multiply_in_GF(uint8_t a, uint8_t b)
+{
+    uint8_t product = 0;
+
+    for (int i = 0; i < 8; i++)
+    {
+        if (b & 1)
+        {
+            product = product ^ a;
+        }
+        b = b >> 1;
+
+        // carry is the leftmost bit in a
+        uint8_t carry = a & 0x80;
+        a = a << 1;
+        if (carry)
+        {
+            a = a ^ 0x1b;
+        }
+    }
+    return product;
+}
+
+/**
+ * Multiplies x by 02 in GF(2^8), a shift and a conditional reduction by 0x1b (section 4.2.1 of FIPS-197)
+ * */
+constexpr uint8_t xtime(uint8_t x)
+{
+    return static_cast<uint8_t>((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+/**
+ * Multiplicative inverse in GF(2^8) as a^254, with 0 mapped to 0 (section 5.1.1 of FIPS-197)
+ * */
+constexpr uint8_t inverse_in_GF(uint8_t a)
+{
+    uint8_t result = 1;
+    uint8_t power = a;
+    for (int exponent = 254; exponent > 0; exponent >>= 1)
+    {
+        if (exponent & 1)
+        {
+            result = multiply_in_GF(result, power);
+        }
+        power = multiply_in_GF(power, power);
+    }
+    return result;
+}
+
+/**
+ * The affine transform of the S-box, b ^ (b <<< 1) ^ (b <<< 2) ^ (b <<< 3) ^ (b <<< 4) ^ 0x63
+ * */
+constexpr uint8_t affine_transform(uint8_t b)
+{
+    uint8_t result = b ^ 0x63;
+    for (int i = 1; i <= 4; i++)
+    {
+        result ^= static_cast<uint8_t>((b << i) | (b >> (8 - i)));
+    }
+    return result;
+}
+
+constexpr uint8_t substitute(uint8_t x)
+{
+    return affine_transform(inverse_in_GF(x));
+}
+
+template <uint8_t coefficient>
+constexpr uint8_t multiply_by(uint8_t x)
+{
+    return multiply_in_GF(x, coefficient);
+}
+
+struct alignas(64) ByteTable
+{
+    uint8_t values[256];
+
+    constexpr uint8_t operator[](size_t i) const
+    {
+        return values[i];
+    }
+};
+
+struct alignas(64) WordTable
+{
+    uint32_t values[256];
+
+    constexpr uint32_t operator[](size_t i) const
+    {
+        return values[i];
+    }
+};
+
+template <uint8_t (*function)(uint8_t)>
+constexpr ByteTable make_byte_table()
+{
+    ByteTable table{};
+    for (int x = 0; x < 256; x++)
+    {
+        table.values[x] = function(static_cast<uint8_t>(x));
+    }
+    return table;
+}
+
+/**
+ * The S_box inverted, as used by InvSubBytes
+ * */
+constexpr ByteTable make_inverse_S_box()
+{
+    ByteTable table{};
+    for (int x = 0; x < 256; x++)
+    {
+        table.values[substitute(static_cast<uint8_t>(x))] = static_cast<uint8_t>(x);
+    }
+    return table;
+}
+
+/**
+ * Builds one of the four T-tables. Te0[x] is the column (02*S[x], S[x], S[x], 03*S[x]) and
+ * Te1..Te3 are the same column rotated right by 1..3 bytes
+ * */
+template <int rotation>
+constexpr WordTable make_T_table()
+{
+    WordTable table{};
+    for (int x = 0; x < 256; x++)
+    {
+        uint8_t s = substitute(static_cast<uint8_t>(x));
+        uint32_t column = (static_cast<uint32_t>(multiply_in_GF(s, 0x02)) << 24) |
+                          (static_cast<uint32_t>(s) << 16) |
+                          (static_cast<uint32_t>(s) << 8) |
+                          static_cast<uint32_t>(multiply_in_GF(s, 0x03));
+        table.values[x] = rotation == 0 ? column : (column >> (8 * rotation)) | (column << (32 - 8 * rotation));
+    }
+    return table;
+}
+
+/**
+ * Builds one of the four inverse T-tables for the equivalent inverse cipher. Td0[x] is the column
+ * (0e*InvS[x], 09*InvS[x], 0d*InvS[x], 0b*InvS[x]) and Td1..Td3 are the same column rotated right by 1..3 bytes
+ * */
+template <int rotation>
+constexpr WordTable make_inverse_T_table()
+{
+    WordTable table{};
+    for (int x = 0; x < 256; x++)
+    {
+        // InvS[substitute(x)] = x
+        uint8_t s = static_cast<uint8_t>(x);
+        uint32_t column = (static_cast<uint32_t>(multiply_in_GF(s, 0x0e)) << 24) |
+                          (static_cast<uint32_t>(multiply_in_GF(s, 0x09)) << 16) |
+                          (static_cast<uint32_t>(multiply_in_GF(s, 0x0d)) << 8) |
+                          static_cast<uint32_t>(multiply_in_GF(s, 0x0b));
+        table.values[substitute(s)] = rotation == 0 ? column : (column >> (8 * rotation)) | (column << (32 - 8 * rotation));
+    }
+    return table;
+}
+
+// round constant word array, x^(i - 1) in GF(2^8) (found here: https://en.wikipedia.org/wiki/AES_key_schedule)
+struct RoundConstants
+{
+    uint8_t values[10];
+
+    constexpr uint8_t operator[](size_t i) const
+    {
+        return values[i];
+    }
+};
+
+constexpr RoundConstants make_Rcon()
+{
+    RoundConstants rcon{};
+    uint8_t power = 1;
+    for (int i = 0; i < 10; i++)
+    {
+        rcon.values[i] = power;
+        power = multiply_in_GF(power, 0x02);
+    }
+    return rcon;
+}
+
+static constexpr RoundConstants Rcon = make_Rcon();
+
+static constexpr ByteTable S_box = make_byte_table<substitute>();
+static constexpr ByteTable InvS_box = make_inverse_S_box();
+
+// multiplication by the MixColumns {02, 03} and InvMixColumns {09, 0b, 0d, 0e} coefficients
+static constexpr ByteTable Mul_02 = make_byte_table<multiply_by<0x02>>();
+static constexpr ByteTable Mul_03 = make_byte_table<multiply_by<0x03>>();
+static constexpr ByteTable Mul_09 = make_byte_table<multiply_by<0x09>>();
+static constexpr ByteTable Mul_0b = make_byte_table<multiply_by<0x0b>>();
+static constexpr ByteTable Mul_0d = make_byte_table<multiply_by<0x0d>>();
+static constexpr ByteTable Mul_0e = make_byte_table<multiply_by<0x0e>>();
+
+static constexpr WordTable Te0 = make_T_table<0>();
+static constexpr WordTable Te1 = make_T_table<1>();
+static constexpr WordTable Te2 = make_T_table<2>();
+static constexpr WordTable Te3 = make_T_table<3>();
+static constexpr WordTable Td0 = make_inverse_T_table<0>();
+static constexpr WordTable Td1 = make_inverse_T_table<1>();
+static constexpr WordTable Td2 = make_inverse_T_table<2>();
+static constexpr WordTable Td3 = make_inverse_T_table<3>();
+
+// spot checks against the tables in FIPS-197 (figure 7 and 14) and the last round constant
+static_assert(S_box[0x00] == 0x63 && S_box[0x53] == 0xed && S_box[0xff] == 0x16, "S_box does not match FIPS-197");
+static_assert(InvS_box[0x63] == 0x00 && InvS_box[0xed] == 0x53 && InvS_box[0x16] == 0xff, "InvS_box does not match FIPS-197");
+static_assert(Rcon[9] == 0x36, "Rcon does not match FIPS-197");
+static_assert(Te0[0x00] == 0xc66363a5 && Te3[0x00] == 0x6363a5c6, "T-tables do not match the S_box");
+static_assert(Td0[0x00] == 0x51f4a750 && Td3[0x00] == 0xf4a75051, "inverse T-tables do not match the InvS_box");
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef AES_TTABLE_HPP
+#define AES_TTABLE_HPP
+
+// T-table round engine.
+//
+// SubBytes, ShiftRows and MixColumns of one column are folded into four 256 entry tables of
+// 32-bit words, so a full round is 16 table lookups and 16 xor's on the four column words.
+// The state is kept as 4 big endian column words, which is the byte order of both the input
+// block and the expanded key, so no transposing is needed.
+// The tables themselves are generated at compile time in aes_tables.hpp.
+// Described in section 5.2.1 of https://csrc.nist.gov/csrc/media/projects/cryptographic-standards-and-guidelines/documents/aes-development/rijndael-ammended.pdf
+
+#include <cstring>
+
+/**
+ * Reads 4 bytes as a big endian word, i.e. one column of the state
+ * */
+static inline uint32_t load_word(uint8_t const *bytes)
+{
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8) | static_cast<uint32_t>(bytes[3]);
+}
+
+/**
+ * Writes a column word back as 4 bytes
+ * */
+static inline void store_word(uint8_t *bytes, uint32_t word)
+{
+    bytes[0] = static_cast<uint8_t>(word >> 24);
+    bytes[1] = static_cast<uint8_t>(word >> 16);
+    bytes[2] = static_cast<uint8_t>(word >> 8);
+    bytes[3] = static_cast<uint8_t>(word);
+}
+
+/**
+ * SubBytes and ShiftRows for one column of the last round, taking row i from the i:th word
+ * */
+static inline uint32_t final_column(uint32_t w0, uint32_t w1, uint32_t w2, uint32_t w3)
+{
+    return (static_cast<uint32_t>(S_box[w0 >> 24]) << 24) | (static_cast<uint32_t>(S_box[(w1 >> 16) & 0xff]) << 16) |
+           (static_cast<uint32_t>(S_box[(w2 >> 8) & 0xff]) << 8) | static_cast<uint32_t>(S_box[w3 & 0xff]);
+}
+
+/**
+ * Encrypts one block with the T-tables. round_keys is an expanded key from ExpandKey.
+ * Gives the same result as Cipher
+ * */
+template <int Nk = ::Nk, int Nr = Nk + 6>
+void Cipher_TTable(uint8_t const *round_keys, uint8_t const *in, uint8_t *out)
+{
+    uint32_t s0 = load_word(in) ^ load_word(round_keys);
+    uint32_t s1 = load_word(in + 4) ^ load_word(round_keys + 4);
+    uint32_t s2 = load_word(in + 8) ^ load_word(round_keys + 8);
+    uint32_t s3 = load_word(in + 12) ^ load_word(round_keys + 12);
+
+    for (int round = 1; round < Nr; round++)
+    {
+        uint8_t const *rk = round_keys + 16 * round;
+        uint32_t t0 = Te0[s0 >> 24] ^ Te1[(s1 >> 16) & 0xff] ^ Te2[(s2 >> 8) & 0xff] ^ Te3[s3 & 0xff] ^ load_word(rk);
+        uint32_t t1 = Te0[s1 >> 24] ^ Te1[(s2 >> 16) & 0xff] ^ Te2[(s3 >> 8) & 0xff] ^ Te3[s0 & 0xff] ^ load_word(rk + 4);
+        uint32_t t2 = Te0[s2 >> 24] ^ Te1[(s3 >> 16) & 0xff] ^ Te2[(s0 >> 8) & 0xff] ^ Te3[s1 & 0xff] ^ load_word(rk + 8);
+        uint32_t t3 = Te0[s3 >> 24] ^ Te1[(s0 >> 16) & 0xff] ^ Te2[(s1 >> 8) & 0xff] ^ Te3[s2 & 0xff] ^ load_word(rk + 12);
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // the last round has no MixColumns, so use the plain S_box
+    uint8_t const *rk = round_keys + 16 * Nr;
+    store_word(out, final_column(s0, s1, s2, s3) ^ load_word(rk));
+    store_word(out + 4, final_column(s1, s2, s3, s0) ^ load_word(rk + 4));
+    store_word(out + 8, final_column(s2, s3, s0, s1) ^ load_word(rk + 8));
+    store_word(out + 12, final_column(s3, s0, s1, s2) ^ load_word(rk + 12));
+}
+
+// ------- Interleaved blocks -------
+// One block is a chain of dependent lookups, each round waits for the loads of the previous one.
+// Carrying N independent blocks through every round together gives an out-of-order core N chains
+// to overlap, and the round key words are loaded once for all of them.
+
+/**
+ * Encrypts N consecutive blocks with the T-tables, round by round side by side. Same result as N calls to Cipher_TTable
+ * */
+template <int N, int Nr>
+static inline void cipher_ttable_blocks(uint8_t const *round_keys, uint8_t const *in, uint8_t *out)
+{
+    uint32_t s[N][4];
+#pragma GCC unroll 8
+    for (int b = 0; b < N; b++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            s[b][c] = load_word(in + 16 * b + 4 * c) ^ load_word(round_keys + 4 * c);
+        }
+    }
+
+    for (int round = 1; round < Nr; round++)
+    {
+        uint8_t const *rk = round_keys + 16 * round;
+        uint32_t k0 = load_word(rk), k1 = load_word(rk + 4), k2 = load_word(rk + 8), k3 = load_word(rk + 12);
+#pragma GCC unroll 8
+        for (int b = 0; b < N; b++)
+        {
+            uint32_t s0 = s[b][0], s1 = s[b][1], s2 = s[b][2], s3 = s[b][3];
+            s[b][0] = Te0[s0 >> 24] ^ Te1[(s1 >> 16) & 0xff] ^ Te2[(s2 >> 8) & 0xff] ^ Te3[s3 & 0xff] ^ k0;
+            s[b][1] = Te0[s1 >> 24] ^ Te1[(s2 >> 16) & 0xff] ^ Te2[(s3 >> 8) & 0xff] ^ Te3[s0 & 0xff] ^ k1;
+            s[b][2] = Te0[s2 >> 24] ^ Te1[(s3 >> 16) & 0xff] ^ Te2[(s0 >> 8) & 0xff] ^ Te3[s1 & 0xff] ^ k2;
+            s[b][3] = Te0[s3 >> 24] ^ Te1[(s0 >> 16) & 0xff] ^ Te2[(s1 >> 8) & 0xff] ^ Te3[s2 & 0xff] ^ k3;
+        }
+    }
+
+    uint8_t const *rk = round_keys + 16 * Nr;
+#pragma GCC unroll 8
+    for (int b = 0; b < N; b++)
+    {
+        uint32_t s0 = s[b][0], s1 = s[b][1], s2 = s[b][2], s3 = s[b][3];
+        store_word(out + 16 * b, final_column(s0, s1, s2, s3) ^ load_word(rk));
+        store_word(out + 16 * b + 4, final_column(s1, s2, s3, s0) ^ load_word(rk + 4));
+        store_word(out + 16 * b + 8, final_column(s2, s3, s0, s1) ^ load_word(rk + 8));
+        store_word(out + 16 * b + 12, final_column(s3, s0, s1, s2) ^ load_word(rk + 12));
+    }
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB) with the T-tables, N blocks at a time (N = 1, 2, 4 or 8)
+ * */
+template <int N, int Nk = ::Nk, int Nr = Nk + 6>
+void EncryptBlocks_TTableInterleaved(uint8_t const *round_keys, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    static_assert(N == 1 || N == 2 || N == 4 || N == 8, "interleave 1, 2, 4 or 8 blocks");
+    const size_t interleaved = nblocks - nblocks % N;
+    for (size_t i = 0; i < interleaved; i += N)
+    {
+        cipher_ttable_blocks<N, Nr>(round_keys, in + 16 * i, out + 16 * i);
+    }
+    for (size_t i = interleaved; i < nblocks; i++)
+    {
+        cipher_ttable_blocks<1, Nr>(round_keys, in + 16 * i, out + 16 * i);
+    }
+}
+
+// blocks in flight for the T-table backend, the fastest factor in `make bench`. With more, the
+// 4 * N state words no longer fit in the general purpose registers of x86-64
+static const int TTABLE_INTERLEAVE = 2;
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB) with the T-tables
+ * */
+template <int Nk = ::Nk, int Nr = Nk + 6>
+void EncryptBlocks_TTable(uint8_t const *round_keys, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    EncryptBlocks_TTableInterleaved<TTABLE_INTERLEAVE, Nk, Nr>(round_keys, in, out, nblocks);
+}
+
+// ------- Decryption -------
+// The equivalent inverse cipher has the same round structure, with the inverse T-tables Td0..Td3
+// and the inverse schedule from InvertSchedule. InvShiftRows takes row r from column c - r, so the
+// words are read in the opposite rotation.
+
+/**
+ * InvSubBytes and InvShiftRows for one column of the last round, taking row i from the i:th word
+ * */
+static inline uint32_t inverse_final_column(uint32_t w0, uint32_t w1, uint32_t w2, uint32_t w3)
+{
+    return (static_cast<uint32_t>(InvS_box[w0 >> 24]) << 24) | (static_cast<uint32_t>(InvS_box[(w1 >> 16) & 0xff]) << 16) |
+           (static_cast<uint32_t>(InvS_box[(w2 >> 8) & 0xff]) << 8) | static_cast<uint32_t>(InvS_box[w3 & 0xff]);
+}
+
+/**
+ * Decrypts N consecutive blocks with the inverse T-tables, round by round side by side. Same result as N calls to EqInvCipher
+ * */
+template <int N, int Nr>
+static inline void inverse_cipher_ttable_blocks(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out)
+{
+    uint32_t s[N][4];
+#pragma GCC unroll 8
+    for (int b = 0; b < N; b++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            s[b][c] = load_word(in + 16 * b + 4 * c) ^ load_word(inverse_schedule + 4 * c);
+        }
+    }
+
+    for (int round = 1; round < Nr; round++)
+    {
+        uint8_t const *rk = inverse_schedule + 16 * round;
+        uint32_t k0 = load_word(rk), k1 = load_word(rk + 4), k2 = load_word(rk + 8), k3 = load_word(rk + 12);
+#pragma GCC unroll 8
+        for (int b = 0; b < N; b++)
+        {
+            uint32_t s0 = s[b][0], s1 = s[b][1], s2 = s[b][2], s3 = s[b][3];
+            s[b][0] = Td0[s0 >> 24] ^ Td1[(s3 >> 16) & 0xff] ^ Td2[(s2 >> 8) & 0xff] ^ Td3[s1 & 0xff] ^ k0;
+            s[b][1] = Td0[s1 >> 24] ^ Td1[(s0 >> 16) & 0xff] ^ Td2[(s3 >> 8) & 0xff] ^ Td3[s2 & 0xff] ^ k1;
+            s[b][2] = Td0[s2 >> 24] ^ Td1[(s1 >> 16) & 0xff] ^ Td2[(s0 >> 8) & 0xff] ^ Td3[s3 & 0xff] ^ k2;
+            s[b][3] = Td0[s3 >> 24] ^ Td1[(s2 >> 16) & 0xff] ^ Td2[(s1 >> 8) & 0xff] ^ Td3[s0 & 0xff] ^ k3;
+        }
+    }
+
+    uint8_t const *rk = inverse_schedule + 16 * Nr;
+#pragma GCC unroll 8
+    for (int b = 0; b < N; b++)
+    {
+        uint32_t s0 = s[b][0], s1 = s[b][1], s2 = s[b][2], s3 = s[b][3];
+        store_word(out + 16 * b, inverse_final_column(s0, s3, s2, s1) ^ load_word(rk));
+        store_word(out + 16 * b + 4, inverse_final_column(s1, s0, s3, s2) ^ load_word(rk + 4));
+        store_word(out + 16 * b + 8, inverse_final_column(s2, s1, s0, s3) ^ load_word(rk + 8));
+        store_word(out + 16 * b + 12, inverse_final_column(s3, s2, s1, s0) ^ load_word(rk + 12));
+    }
+}
+
+/**
+ * Decrypts nblocks consecutive blocks (ECB) with the inverse T-tables, TTABLE_INTERLEAVE at a time.
+ * inverse_schedule is from InvertSchedule
+ * */
+template <int Nk = ::Nk, int Nr = Nk + 6>
+void DecryptBlocks_TTable(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    const size_t interleaved = nblocks - nblocks % TTABLE_INTERLEAVE;
+    for (size_t i = 0; i < interleaved; i += TTABLE_INTERLEAVE)
+    {
+        inverse_cipher_ttable_blocks<TTABLE_INTERLEAVE, Nr>(inverse_schedule, in + 16 * i, out + 16 * i);
+    }
+    for (size_t i = interleaved; i < nblocks; i++)
+    {
+        inverse_cipher_ttable_blocks<1, Nr>(inverse_schedule, in + 16 * i, out + 16 * i);
+    }
+}
+
+#endif
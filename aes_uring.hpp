@@ -0,0 +1,421 @@
+#ifndef AES_URING_HPP
+#define AES_URING_HPP
+
+// io_uring file mode.
+//
+// Encrypts one file into another with a queue of reads and writes in flight through io_uring,
+// set up with the raw system calls (no liburing). A fixed pool of page aligned buffers is
+// registered with the kernel once, so the fixed reads and writes do not pin and unpin pages on
+// every request. Every buffer goes around read -> encrypt in place -> write -> read the next
+// chunk. The completions are handled, and all the new requests submitted, with one io_uring_enter
+// per pass, so with many requests in flight there is far less than a system call per read or write.
+// The buffers whose reads completed in a pass are encrypted together, their chunks spread over the
+// thread pool, before their writes are queued.
+// Where io_uring is not available (old kernels, or disabled by kernel.io_uring_disabled or a
+// seccomp filter) encrypt_file_uring falls back to the memory-mapped encrypt_file.
+// Like the streaming mode, a trailing partial block is padded with zero bytes.
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+// bytes per buffer, a multiple of 16
+static const size_t URING_CHUNK_SIZE = 1 << 18;
+// buffers in the pool, and so requests in flight
+static const unsigned URING_DEPTH = 16;
+
+/**
+ * An io_uring instance: the submission queue, the completion queue and their shared memory
+ * */
+class IoUring
+{
+public:
+    IoUring() = default;
+    IoUring(IoUring const &) = delete;
+    IoUring &operator=(IoUring const &) = delete;
+
+    ~IoUring()
+    {
+        if (sqes != nullptr)
+        {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_ring != nullptr && cq_ring != sq_ring)
+        {
+            munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != nullptr)
+        {
+            munmap(sq_ring, sq_ring_size);
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    /**
+     * Creates the rings with room for entries requests. false (with errno set) if io_uring is not available
+     * */
+    bool setup(unsigned entries)
+    {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        // newer kernels put both rings in one mapping
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap && cq_ring_size > sq_ring_size)
+        {
+            sq_ring_size = cq_ring_size;
+        }
+        sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+        if (sq_ring == nullptr)
+        {
+            return false;
+        }
+        cq_ring = single_mmap ? sq_ring : map(cq_ring_size, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = reinterpret_cast<struct io_uring_sqe *>(map(sqes_size, IORING_OFF_SQES));
+        if (cq_ring == nullptr || sqes == nullptr)
+        {
+            return false;
+        }
+
+        sq_head = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned *>(sq_ring + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned *>(cq_ring + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq_ring + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned *>(cq_ring + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe *>(cq_ring + params.cq_off.cqes);
+        sq_entries = params.sq_entries;
+        return true;
+    }
+
+    /**
+     * Registers buffers for the fixed reads and writes, buf_index is the position in buffers
+     * */
+    bool register_buffers(struct iovec const *buffers, unsigned count)
+    {
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+    }
+
+    /**
+     * Queues a read or write of length bytes at offset of the file fd from or into buffer, which
+     * is registered buffer buf_index. Returns false if the submission queue is full
+     * */
+    bool queue(uint8_t opcode, int file, uint8_t *buffer, size_t length, uint64_t offset, uint16_t buf_index, uint64_t user_data)
+    {
+        unsigned tail = *sq_tail;
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries)
+        {
+            return false;
+        }
+        unsigned index = tail & sq_mask;
+        struct io_uring_sqe &sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = static_cast<uint32_t>(length);
+        sqe.off = offset;
+        sqe.buf_index = buf_index;
+        sqe.user_data = user_data;
+        sq_array[index] = index;
+        // the kernel may read the entry as soon as it sees the new tail
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        queued++;
+        return true;
+    }
+
+    /**
+     * Submits everything queued and waits until at least min_complete requests have completed
+     * */
+    bool submit_and_wait(unsigned min_complete)
+    {
+        while (true)
+        {
+            long submitted = syscall(__NR_io_uring_enter, fd, queued, min_complete, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (submitted >= 0)
+            {
+                queued -= static_cast<unsigned>(submitted);
+                return true;
+            }
+            if (errno != EINTR)
+            {
+                return false;
+            }
+        }
+    }
+
+    /**
+     * Waits until at least min_complete requests have completed, without submitting anything
+     * */
+    bool wait(unsigned min_complete)
+    {
+        while (syscall(__NR_io_uring_enter, fd, 0, min_complete, IORING_ENTER_GETEVENTS, nullptr, 0) < 0)
+        {
+            if (errno != EINTR)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Requests queued since the last io_uring_enter, the kernel has not seen them
+     * */
+    unsigned unsubmitted() const
+    {
+        return queued;
+    }
+
+    /**
+     * Takes the next completion, false if there is none
+     * */
+    bool pop_completion(struct io_uring_cqe &completion)
+    {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }
+        completion = cqes[head & cq_mask];
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    uint8_t *map(size_t size, off_t offset)
+    {
+        void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return mapping == MAP_FAILED ? nullptr : static_cast<uint8_t *>(mapping);
+    }
+
+    int fd = -1;
+    uint8_t *sq_ring = nullptr, *cq_ring = nullptr;
+    size_t sq_ring_size = 0, cq_ring_size = 0, sqes_size = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr;
+    unsigned sq_mask = 0, cq_mask = 0, sq_entries = 0;
+    struct io_uring_cqe *cqes = nullptr;
+    // entries queued since the last io_uring_enter
+    unsigned queued = 0;
+};
+
+/**
+ * A buffer of the pool and the chunk it is reading or writing
+ * */
+struct UringBuffer
+{
+    uint8_t *data;
+    // plaintext offset of the chunk
+    uint64_t offset;
+    // bytes to read or write, and how many of them are done
+    size_t length, done;
+    bool writing;
+};
+
+/**
+ * Encrypts the file in_path (the key of key_size bytes followed by the plaintext) into out_path through io_uring,
+ * or through memory mappings if io_uring is not available. Returns false after printing the
+ * reason if a file cannot be opened, read or written
+ * */
+static bool encrypt_file_uring(char const *in_path, char const *out_path, size_t key_size = KEY_SIZE)
+{
+    // freed after the ring is closed, the kernel may still be using it until then
+    uint8_t *pool = nullptr;
+    if (posix_memalign(reinterpret_cast<void **>(&pool), 4096, URING_DEPTH * URING_CHUNK_SIZE) != 0)
+    {
+        return encrypt_file(in_path, out_path, key_size);
+    }
+    std::unique_ptr<uint8_t, void (*)(void *)> pool_owner(pool, std::free);
+    IoUring ring;
+    if (!ring.setup(URING_DEPTH))
+    {
+        return encrypt_file(in_path, out_path, key_size);
+    }
+    std::vector<UringBuffer> buffers(URING_DEPTH);
+    std::vector<struct iovec> iovecs(URING_DEPTH);
+    for (unsigned b = 0; b < URING_DEPTH; b++)
+    {
+        buffers[b].data = pool + b * URING_CHUNK_SIZE;
+        iovecs[b] = {buffers[b].data, URING_CHUNK_SIZE};
+    }
+    // registering can fail on the locked memory limit, plain reads and writes still work then
+    const bool fixed = ring.register_buffers(iovecs.data(), URING_DEPTH);
+
+    bool ok = false;
+    MappedFile input, output;
+    uint8_t key[MAX_KEY_SIZE];
+    struct stat status;
+    input.fd = open(in_path, O_RDONLY);
+    if (input.fd < 0 || fstat(input.fd, &status) != 0)
+    {
+        std::cerr << "cannot open " << in_path << ": " << std::strerror(errno) << std::endl;
+    }
+    else if (static_cast<size_t>(status.st_size) < key_size ||
+             pread(input.fd, key, key_size, 0) != static_cast<ssize_t>(key_size))
+    {
+        std::cerr << in_path << " is too short for a key" << std::endl;
+    }
+    else if (output.open_output(out_path, 0, input.fd))
+    {
+        ok = true;
+    }
+    if (!ok)
+    {
+        return false;
+    }
+
+    const Schedule schedule(key, key_size);
+    const uint64_t plaintext_size = static_cast<uint64_t>(status.st_size) - key_size;
+    const uint64_t padded_size = (plaintext_size + 15) / 16 * 16;
+    if (padded_size > 0 && fallocate(output.fd, 0, 0, static_cast<off_t>(padded_size)) != 0 &&
+        errno != EOPNOTSUPP)
+    {
+        std::cerr << "cannot allocate " << out_path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    const uint8_t read_op = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    const uint8_t write_op = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    uint64_t next_offset = 0;
+    unsigned in_flight = 0;
+    // queues what is left of the buffer's read or write, there is always room as every buffer has at most one request
+    auto resume = [&](unsigned b) {
+        UringBuffer &buffer = buffers[b];
+        ring.queue(buffer.writing ? write_op : read_op, buffer.writing ? output.fd : input.fd, buffer.data + buffer.done,
+                   buffer.length - buffer.done, (buffer.writing ? 0 : key_size) + buffer.offset + buffer.done,
+                   static_cast<uint16_t>(b), b);
+        in_flight++;
+    };
+    auto read_next_chunk = [&](unsigned b) {
+        if (!ok || next_offset >= plaintext_size)
+        {
+            return;
+        }
+        UringBuffer &buffer = buffers[b];
+        buffer.offset = next_offset;
+        buffer.length = plaintext_size - next_offset < URING_CHUNK_SIZE ? static_cast<size_t>(plaintext_size - next_offset)
+                                                                         : URING_CHUNK_SIZE;
+        buffer.done = 0;
+        buffer.writing = false;
+        next_offset += buffer.length;
+        resume(b);
+    };
+
+    // the buffers read in this pass, encrypted together on the pool
+    std::vector<unsigned> ready;
+    ready.reserve(URING_DEPTH);
+    const size_t chunks_per_buffer = (URING_CHUNK_SIZE / 16 + PARALLEL_CHUNK_BLOCKS - 1) / PARALLEL_CHUNK_BLOCKS;
+    auto encrypt_ready = [&]() {
+        ThreadPool::shared().parallel_for(ready.size() * chunks_per_buffer, [&](size_t chunk) {
+            UringBuffer &buffer = buffers[ready[chunk / chunks_per_buffer]];
+            const size_t nblocks = buffer.length / 16, first = chunk % chunks_per_buffer * PARALLEL_CHUNK_BLOCKS;
+            if (first < nblocks)
+            {
+                encrypt_blocks_in_place(schedule, buffer.data + 16 * first,
+                                        nblocks - first < PARALLEL_CHUNK_BLOCKS ? nblocks - first : PARALLEL_CHUNK_BLOCKS);
+            }
+        });
+        for (unsigned b : ready)
+        {
+            buffers[b].done = 0;
+            buffers[b].writing = true;
+            resume(b);
+        }
+        ready.clear();
+    };
+
+    for (unsigned b = 0; b < URING_DEPTH; b++)
+    {
+        read_next_chunk(b);
+    }
+    while (in_flight > 0)
+    {
+        if (!ring.submit_and_wait(1))
+        {
+            std::cerr << "io_uring_enter failed: " << std::strerror(errno) << std::endl;
+            // the submitted requests may still read into or write from the pool, wait for them
+            unsigned submitted = in_flight - ring.unsubmitted();
+            struct io_uring_cqe completion;
+            while (submitted > 0)
+            {
+                if (!ring.wait(1))
+                {
+                    // no way to know when the kernel is done with the pool, so it is never freed
+                    pool_owner.release();
+                    return false;
+                }
+                while (submitted > 0 && ring.pop_completion(completion))
+                {
+                    submitted--;
+                }
+            }
+            return false;
+        }
+        struct io_uring_cqe completion;
+        while (ring.pop_completion(completion))
+        {
+            in_flight--;
+            unsigned b = static_cast<unsigned>(completion.user_data);
+            UringBuffer &buffer = buffers[b];
+            if (completion.res <= 0)
+            {
+                // a read of 0 bytes means the file was shortened under us
+                if (ok)
+                {
+                    std::cerr << (buffer.writing ? "write failed: " : "read failed: ")
+                              << std::strerror(completion.res < 0 ? -completion.res : EIO) << std::endl;
+                }
+                ok = false;
+                continue;
+            }
+            buffer.done += static_cast<size_t>(completion.res);
+            if (buffer.done < buffer.length)
+            {
+                resume(b);
+            }
+            else if (!buffer.writing)
+            {
+                if (buffer.length % 16 != 0)
+                {
+                    std::memset(buffer.data + buffer.length, 0, 16 - buffer.length % 16);
+                    buffer.length += 16 - buffer.length % 16;
+                }
+                ready.push_back(b);
+            }
+            else
+            {
+                read_next_chunk(b);
+            }
+        }
+        if (!ready.empty())
+        {
+            encrypt_ready();
+        }
+    }
+    return ok;
+}
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef AES_VAES_HPP
+#define AES_VAES_HPP
+
+// VAES backends.
+//
+// VAES extends aesenc/aesenclast to ymm and zmm registers, where they run one round on 2 or 4
+// independent blocks per instruction. The key schedule is the same as for AES-NI, with each round
+// key broadcast to every 128-bit lane. vaesdec/vaesdeclast decrypt the same way from the inverse schedule.
+// Ice Lake, Zen 3 (256-bit only) and Zen 4 or newer have VAES.
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define VAES256_TARGET __attribute__((target("aes,vaes,avx2")))
+#define VAES512_TARGET __attribute__((target("aes,vaes,avx2,avx512f")))
+
+// registers kept in flight by the wide loops. AVX2 only has 16 ymm registers and 11 to 15 of them
+// hold the round keys (the rest are read from the stack), AVX-512 has 32
+static const int VAES256_REGISTERS = 4;
+static const int VAES512_REGISTERS = 8;
+
+/**
+ * A round key in all four lanes of a zmm register. The zeroing form of the broadcast with every
+ * lane selected: the plain one passes an undefined merge operand that GCC 12 reports as uninitialized
+ * */
+VAES512_TARGET static inline __m512i broadcast_512(__m128i round_key)
+{
+    return _mm512_maskz_broadcast_i32x4(0xffff, round_key);
+}
+
+/**
+ * Encrypts the blocks that are left after the wide loops, one at a time with AES-NI
+ * */
+template <int Nr>
+AESNI_TARGET static void vaes_tail(__m128i const *round_keys, __m128i const *src, __m128i *dst, size_t nblocks)
+{
+    for (size_t i = 0; i < nblocks; i++)
+    {
+        __m128i state = _mm_xor_si128(_mm_loadu_si128(src + i), round_keys[0]);
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            state = _mm_aesenc_si128(state, round_keys[round]);
+        }
+        _mm_storeu_si128(dst + i, _mm_aesenclast_si128(state, round_keys[Nr]));
+    }
+}
+
+/**
+ * Decrypts the blocks that are left after the wide loops, one at a time with AES-NI
+ * */
+template <int Nr>
+AESNI_TARGET static void vaes_inverse_tail(__m128i const *round_keys, __m128i const *src, __m128i *dst, size_t nblocks)
+{
+    for (size_t i = 0; i < nblocks; i++)
+    {
+        __m128i state = _mm_xor_si128(_mm_loadu_si128(src + i), round_keys[0]);
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            state = _mm_aesdec_si128(state, round_keys[round]);
+        }
+        _mm_storeu_si128(dst + i, _mm_aesdeclast_si128(state, round_keys[Nr]));
+    }
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB), two blocks per ymm register
+ * */
+template <int Nk, int Nr = Nk + 6>
+VAES256_TARGET void EncryptBlocks_VAES256(uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    __m128i round_keys[Nr + 1];
+    __m256i wide_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(schedule) + round);
+        wide_keys[round] = _mm256_broadcastsi128_si256(round_keys[round]);
+    }
+
+    const size_t step = 2 * VAES256_REGISTERS;
+    size_t i = 0;
+    for (; i + step <= nblocks; i += step)
+    {
+        __m256i state[VAES256_REGISTERS];
+        for (int r = 0; r < VAES256_REGISTERS; r++)
+        {
+            state[r] = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(in + 16 * (i + 2 * r))), wide_keys[0]);
+        }
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int r = 0; r < VAES256_REGISTERS; r++)
+            {
+                state[r] = _mm256_aesenc_epi128(state[r], wide_keys[round]);
+            }
+        }
+        for (int r = 0; r < VAES256_REGISTERS; r++)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 16 * (i + 2 * r)), _mm256_aesenclast_epi128(state[r], wide_keys[Nr]));
+        }
+    }
+
+    vaes_tail<Nr>(round_keys, reinterpret_cast<__m128i const *>(in) + i, reinterpret_cast<__m128i *>(out) + i, nblocks - i);
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB), four blocks per zmm register
+ * */
+template <int Nk, int Nr = Nk + 6>
+VAES512_TARGET void EncryptBlocks_VAES512(uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    __m128i round_keys[Nr + 1];
+    __m512i wide_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(schedule) + round);
+        wide_keys[round] = broadcast_512(round_keys[round]);
+    }
+
+    const size_t step = 4 * VAES512_REGISTERS;
+    size_t i = 0;
+    for (; i + step <= nblocks; i += step)
+    {
+        __m512i state[VAES512_REGISTERS];
+        for (int r = 0; r < VAES512_REGISTERS; r++)
+        {
+            state[r] = _mm512_xor_si512(_mm512_loadu_si512(in + 16 * (i + 4 * r)), wide_keys[0]);
+        }
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int r = 0; r < VAES512_REGISTERS; r++)
+            {
+                state[r] = _mm512_aesenc_epi128(state[r], wide_keys[round]);
+            }
+        }
+        for (int r = 0; r < VAES512_REGISTERS; r++)
+        {
+            _mm512_storeu_si512(out + 16 * (i + 4 * r), _mm512_aesenclast_epi128(state[r], wide_keys[Nr]));
+        }
+    }
+
+    // single zmm registers for what is left of the last group
+    for (; i + 4 <= nblocks; i += 4)
+    {
+        __m512i state = _mm512_xor_si512(_mm512_loadu_si512(in + 16 * i), wide_keys[0]);
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            state = _mm512_aesenc_epi128(state, wide_keys[round]);
+        }
+        _mm512_storeu_si512(out + 16 * i, _mm512_aesenclast_epi128(state, wide_keys[Nr]));
+    }
+
+    vaes_tail<Nr>(round_keys, reinterpret_cast<__m128i const *>(in) + i, reinterpret_cast<__m128i *>(out) + i, nblocks - i);
+}
+
+/**
+ * Decrypts nblocks consecutive blocks (ECB) with vaesdec, two blocks per ymm register. inverse_schedule is from InvertSchedule
+ * */
+template <int Nk, int Nr = Nk + 6>
+VAES256_TARGET void DecryptBlocks_VAES256(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    __m128i round_keys[Nr + 1];
+    __m256i wide_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(inverse_schedule) + round);
+        wide_keys[round] = _mm256_broadcastsi128_si256(round_keys[round]);
+    }
+
+    const size_t step = 2 * VAES256_REGISTERS;
+    size_t i = 0;
+    for (; i + step <= nblocks; i += step)
+    {
+        __m256i state[VAES256_REGISTERS];
+        for (int r = 0; r < VAES256_REGISTERS; r++)
+        {
+            state[r] = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(in + 16 * (i + 2 * r))), wide_keys[0]);
+        }
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int r = 0; r < VAES256_REGISTERS; r++)
+            {
+                state[r] = _mm256_aesdec_epi128(state[r], wide_keys[round]);
+            }
+        }
+        for (int r = 0; r < VAES256_REGISTERS; r++)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 16 * (i + 2 * r)), _mm256_aesdeclast_epi128(state[r], wide_keys[Nr]));
+        }
+    }
+
+    vaes_inverse_tail<Nr>(round_keys, reinterpret_cast<__m128i const *>(in) + i, reinterpret_cast<__m128i *>(out) + i, nblocks - i);
+}
+
+/**
+ * Decrypts nblocks consecutive blocks (ECB) with vaesdec, four blocks per zmm register. inverse_schedule is from InvertSchedule
+ * */
+template <int Nk, int Nr = Nk + 6>
+VAES512_TARGET void DecryptBlocks_VAES512(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    __m128i round_keys[Nr + 1];
+    __m512i wide_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(inverse_schedule) + round);
+        wide_keys[round] = broadcast_512(round_keys[round]);
+    }
+
+    const size_t step = 4 * VAES512_REGISTERS;
+    size_t i = 0;
+    for (; i + step <= nblocks; i += step)
+    {
+        __m512i state[VAES512_REGISTERS];
+        for (int r = 0; r < VAES512_REGISTERS; r++)
+        {
+            state[r] = _mm512_xor_si512(_mm512_loadu_si512(in + 16 * (i + 4 * r)), wide_keys[0]);
+        }
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            for (int r = 0; r < VAES512_REGISTERS; r++)
+            {
+                state[r] = _mm512_aesdec_epi128(state[r], wide_keys[round]);
+            }
+        }
+        for (int r = 0; r < VAES512_REGISTERS; r++)
+        {
+            _mm512_storeu_si512(out + 16 * (i + 4 * r), _mm512_aesdeclast_epi128(state[r], wide_keys[Nr]));
+        }
+    }
+
+    // single zmm registers for what is left of the last group
+    for (; i + 4 <= nblocks; i += 4)
+    {
+        __m512i state = _mm512_xor_si512(_mm512_loadu_si512(in + 16 * i), wide_keys[0]);
+#pragma GCC unroll 14
+        for (int round = 1; round < Nr; round++)
+        {
+            state = _mm512_aesdec_epi128(state, wide_keys[round]);
+        }
+        _mm512_storeu_si512(out + 16 * i, _mm512_aesdeclast_epi128(state, wide_keys[Nr]));
+    }
+
+    vaes_inverse_tail<Nr>(round_keys, reinterpret_cast<__m128i const *>(in) + i, reinterpret_cast<__m128i *>(out) + i, nblocks - i);
+}
+
+#endif
+
+#endif
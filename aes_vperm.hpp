@@ -0,0 +1,420 @@
+#ifndef AES_VPERM_HPP
+#define AES_VPERM_HPP
+
+// Vector permute backend.
+//
+// SubBytes is computed on a whole 128-bit state with pshufb, which looks up 16 nibbles in a 16 byte
+// table held in a register, so no memory access depends on the data. The idea is from
+// Hamburg, "Accelerating AES with Vector Permute Instructions", https://shiftleft.com/mirrors/www.hamburgrs.net/papers/vector_aes.pdf
+//
+// GF(2^8) is written as GF(2^4)[beta] / (beta^2 + beta + lambda), so a byte is i + k * beta with
+// nibbles i and k. With j = i + k and c = 1 / lambda, the inverse of a byte is
+//     1/v * (lambda + beta) + 1/w * (1 + lambda + beta)
+// where  v = j + 1 / (1/i + c/k)  and  w = i + 1 / (1/j + c/k).
+// Each step is a lookup of one nibble, and 1/0 is a marker with the high bit set, which makes
+// pshufb return 0 and gives the right answer when i, j or k is 0.
+// The change of basis in and out of the tower field is linear, so it is folded into the first
+// and last lookups, together with the affine transform of the S-box.
+// InvSubBytes is the inverse of the inverse affine transform, so it is the same lookups with
+// that transform folded into the first ones instead.
+//
+// The key schedule runs SubWord through the same lookups, in ExpandKey_VPerm.
+//
+// Unlike the bitsliced backends this needs no more than one block to fill its registers, so it
+// is fast for short messages.
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cstring>
+#include <tmmintrin.h>
+
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+
+/**
+ * Multiplies a and b in GF(2^4) = GF(2)[z] / (z^4 + z + 1)
+ * */
+constexpr uint8_t multiply_in_GF16(uint8_t a, uint8_t b)
+{
+    uint8_t product = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (b & 1)
+        {
+            product = product ^ a;
+        }
+        b = b >> 1;
+        uint8_t carry = a & 0x08;
+        a = (a << 1) & 0x0f;
+        if (carry)
+        {
+            a = a ^ 0x03;
+        }
+    }
+    return product;
+}
+
+constexpr uint8_t inverse_in_GF16(uint8_t a)
+{
+    for (uint8_t b = 1; b < 16; b++)
+    {
+        if (multiply_in_GF16(a, b) == 1)
+        {
+            return b;
+        }
+    }
+    return 0;
+}
+
+/**
+ * The linear part of the S-box affine transform, b ^ (b <<< 1) ^ (b <<< 2) ^ (b <<< 3) ^ (b <<< 4)
+ * */
+constexpr uint8_t affine_linear(uint8_t b)
+{
+    uint8_t result = b;
+    for (int i = 1; i <= 4; i++)
+    {
+        result ^= static_cast<uint8_t>((b << i) | (b >> (8 - i)));
+    }
+    return result;
+}
+
+/**
+ * The linear part of the inverse affine transform, (b <<< 1) ^ (b <<< 3) ^ (b <<< 6). Its constant is 0x05
+ * */
+constexpr uint8_t inverse_affine_linear(uint8_t b)
+{
+    return static_cast<uint8_t>(((b << 1) | (b >> 7)) ^ ((b << 3) | (b >> 5)) ^ ((b << 6) | (b >> 2)));
+}
+
+struct VPermTables
+{
+    // AES byte to tower field, indexed by the low and the high nibble
+    alignas(16) uint8_t in_low[16];
+    alignas(16) uint8_t in_high[16];
+    // 1/x and c/x in GF(2^4), with 1/0 = 0x80
+    alignas(16) uint8_t inverse[16];
+    alignas(16) uint8_t c_over[16];
+    // affine_linear of 1/v * (lambda + beta) and 1/w * (1 + lambda + beta) back in the AES basis
+    alignas(16) uint8_t out_v[16];
+    alignas(16) uint8_t out_w[16];
+    // the same for InvSubBytes: the inverse affine transform and then the tower field, and back without the affine transform
+    alignas(16) uint8_t inverse_in_low[16];
+    alignas(16) uint8_t inverse_in_high[16];
+    alignas(16) uint8_t inverse_out_v[16];
+    alignas(16) uint8_t inverse_out_w[16];
+};
+
+/**
+ * Finds the tower field representation and builds the lookup tables from it, at compile time
+ * */
+constexpr VPermTables make_vperm_tables()
+{
+    // g is a root of z^4 + z + 1 in the AES field, so nibble n maps to the sum of g^m over its bits m
+    uint8_t g = 2;
+    while ((multiply_in_GF(multiply_in_GF(g, g), multiply_in_GF(g, g)) ^ g ^ 1) != 0)
+    {
+        g++;
+    }
+    uint8_t nibble_to_byte[16] = {};
+    for (int n = 0; n < 16; n++)
+    {
+        uint8_t sum = 0, power = 1;
+        for (int m = 0; m < 4; m++)
+        {
+            if ((n >> m) & 1)
+            {
+                sum ^= power;
+            }
+            power = multiply_in_GF(power, g);
+        }
+        nibble_to_byte[n] = sum;
+    }
+
+    // beta^2 + beta + lambda is irreducible when the trace of lambda is 1
+    uint8_t lambda = 1;
+    while (true)
+    {
+        uint8_t trace = lambda, power = lambda;
+        for (int m = 0; m < 3; m++)
+        {
+            power = multiply_in_GF16(power, power);
+            trace ^= power;
+        }
+        if (trace == 1)
+        {
+            break;
+        }
+        lambda++;
+    }
+    uint8_t beta = 0;
+    while ((multiply_in_GF(beta, beta) ^ beta ^ nibble_to_byte[lambda]) != 0)
+    {
+        beta++;
+    }
+
+    // tower byte (k << 4) | i is i + k * beta
+    uint8_t to_aes[256] = {}, from_aes[256] = {};
+    for (int t = 0; t < 256; t++)
+    {
+        to_aes[t] = nibble_to_byte[t & 0x0f] ^ multiply_in_GF(nibble_to_byte[t >> 4], beta);
+        from_aes[to_aes[t]] = static_cast<uint8_t>(t);
+    }
+
+    VPermTables tables{};
+    uint8_t c = inverse_in_GF16(lambda);
+    for (int n = 0; n < 16; n++)
+    {
+        uint8_t inverse = inverse_in_GF16(static_cast<uint8_t>(n));
+        tables.in_low[n] = from_aes[n];
+        tables.in_high[n] = from_aes[n << 4];
+        tables.inverse[n] = n == 0 ? 0x80 : inverse;
+        tables.c_over[n] = n == 0 ? 0x80 : multiply_in_GF16(c, inverse);
+        tables.out_v[n] = affine_linear(to_aes[(inverse << 4) | multiply_in_GF16(lambda, inverse)]);
+        tables.out_w[n] = affine_linear(to_aes[(inverse << 4) | multiply_in_GF16(lambda ^ 1, inverse)]);
+        tables.inverse_in_low[n] = from_aes[inverse_affine_linear(static_cast<uint8_t>(n)) ^ 0x05];
+        tables.inverse_in_high[n] = from_aes[inverse_affine_linear(static_cast<uint8_t>(n << 4))];
+        tables.inverse_out_v[n] = to_aes[(inverse << 4) | multiply_in_GF16(lambda, inverse)];
+        tables.inverse_out_w[n] = to_aes[(inverse << 4) | multiply_in_GF16(lambda ^ 1, inverse)];
+    }
+    return tables;
+}
+
+static constexpr VPermTables VPERM_TABLES = make_vperm_tables();
+
+/**
+ * The tables and masks in registers
+ * */
+struct VPermRegisters
+{
+    __m128i in_low, in_high, inverse, c_over, out_v, out_w;
+    __m128i inverse_in_low, inverse_in_high, inverse_out_v, inverse_out_w;
+    __m128i low_nibbles, affine_constant, reduction, shift_rows, inverse_shift_rows, rotate_1, rotate_2;
+};
+
+SSSE3_TARGET static inline VPermRegisters vperm_load_registers()
+{
+    VPermRegisters r;
+    r.in_low = _mm_load_si128(reinterpret_cast<__m128i const *>(VPERM_TABLES.in_low));
+    r.in_high = _mm_load_si128(reinterpret_cast<__m128i const *>(VPERM_TABLES.in_high));
+    r.inverse = _mm_load_si128(reinterpret_cast<__m128i const *>(VPERM_TABLES.inverse));
+    r.c_over = _mm_load_si128(reinterpret_cast<__m128i const *>(VPERM_TABLES.c_over));
+    r.out_v = _mm_load_si128(reinterpret_cast<__m128i const *>(VPERM_TABLES.out_v));
+    r.out_w = _mm_load_si128(reinterpret_cast<__m128i const *>(VPERM_TABLES.out_w));
+    r.inverse_in_low = _mm_load_si128(reinterpret_cast<__m128i const *>(VPERM_TABLES.inverse_in_low));
+    r.inverse_in_high = _mm_load_si128(reinterpret_cast<__m128i const *>(VPERM_TABLES.inverse_in_high));
+    r.inverse_out_v = _mm_load_si128(reinterpret_cast<__m128i const *>(VPERM_TABLES.inverse_out_v));
+    r.inverse_out_w = _mm_load_si128(reinterpret_cast<__m128i const *>(VPERM_TABLES.inverse_out_w));
+    r.low_nibbles = _mm_set1_epi8(0x0f);
+    r.affine_constant = _mm_set1_epi8(0x63);
+    r.reduction = _mm_set1_epi8(0x1b);
+    // byte p of the state is row p % 4 of column p / 4
+    r.shift_rows = _mm_setr_epi8(0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11);
+    r.inverse_shift_rows = _mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3);
+    r.rotate_1 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    r.rotate_2 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    return r;
+}
+
+/**
+ * Inverts all 16 bytes in the tower field, with the linear maps in_low / in_high before and out_v / out_w after
+ * */
+SSSE3_TARGET static inline __m128i vperm_invert(VPermRegisters const &r, __m128i x, __m128i in_low, __m128i in_high,
+                                                __m128i out_v, __m128i out_w)
+{
+    // into the tower field, i is the low nibble and k the high one
+    __m128i tower = _mm_xor_si128(_mm_shuffle_epi8(in_low, _mm_and_si128(x, r.low_nibbles)),
+                                  _mm_shuffle_epi8(in_high, _mm_and_si128(_mm_srli_epi16(x, 4), r.low_nibbles)));
+    __m128i i = _mm_and_si128(tower, r.low_nibbles);
+    __m128i k = _mm_and_si128(_mm_srli_epi16(tower, 4), r.low_nibbles);
+    __m128i j = _mm_xor_si128(i, k);
+
+    __m128i c_over_k = _mm_shuffle_epi8(r.c_over, k);
+    __m128i v = _mm_xor_si128(j, _mm_shuffle_epi8(r.inverse, _mm_xor_si128(_mm_shuffle_epi8(r.inverse, i), c_over_k)));
+    __m128i w = _mm_xor_si128(i, _mm_shuffle_epi8(r.inverse, _mm_xor_si128(_mm_shuffle_epi8(r.inverse, j), c_over_k)));
+
+    return _mm_xor_si128(_mm_shuffle_epi8(out_v, v), _mm_shuffle_epi8(out_w, w));
+}
+
+/**
+ * SubBytes on all 16 bytes of the state
+ * */
+SSSE3_TARGET static inline __m128i vperm_sub_bytes(VPermRegisters const &r, __m128i x)
+{
+    return _mm_xor_si128(vperm_invert(r, x, r.in_low, r.in_high, r.out_v, r.out_w), r.affine_constant);
+}
+
+/**
+ * InvSubBytes on all 16 bytes of the state
+ * */
+SSSE3_TARGET static inline __m128i vperm_inv_sub_bytes(VPermRegisters const &r, __m128i x)
+{
+    return vperm_invert(r, x, r.inverse_in_low, r.inverse_in_high, r.inverse_out_v, r.inverse_out_w);
+}
+
+/**
+ * Multiplies every byte by 02
+ * */
+SSSE3_TARGET static inline __m128i vperm_xtime(VPermRegisters const &r, __m128i x)
+{
+    __m128i carries = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(carries, r.reduction));
+}
+
+/**
+ * MixColumns as 02 * (s ^ r1) ^ r1 ^ r2(s ^ r1), where r1 and r2 rotate every column up by 1 and 2 rows
+ * */
+SSSE3_TARGET static inline __m128i vperm_mix_columns(VPermRegisters const &r, __m128i x)
+{
+    __m128i rotated = _mm_shuffle_epi8(x, r.rotate_1);
+    __m128i d = _mm_xor_si128(x, rotated);
+    return _mm_xor_si128(_mm_xor_si128(vperm_xtime(r, d), rotated), _mm_shuffle_epi8(d, r.rotate_2));
+}
+
+/**
+ * InvMixColumns as MixColumns of s ^ 04 * (s ^ r2), see InvMixColumn_SWAR
+ * */
+SSSE3_TARGET static inline __m128i vperm_inv_mix_columns(VPermRegisters const &r, __m128i x)
+{
+    __m128i pairs = _mm_xor_si128(x, _mm_shuffle_epi8(x, r.rotate_2));
+    return vperm_mix_columns(r, _mm_xor_si128(x, vperm_xtime(r, vperm_xtime(r, pairs))));
+}
+
+/**
+ * Encrypts N blocks side by side, so the dependency chains of the lookups can overlap
+ * */
+template <int N, int Nr>
+SSSE3_TARGET static inline void vperm_cipher(VPermRegisters const &r, __m128i const *round_keys, uint8_t const *in, uint8_t *out)
+{
+    __m128i state[N];
+    for (int b = 0; b < N; b++)
+    {
+        state[b] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(in) + b), round_keys[0]);
+    }
+    for (int round = 1; round < Nr; round++)
+    {
+        for (int b = 0; b < N; b++)
+        {
+            state[b] = _mm_shuffle_epi8(vperm_sub_bytes(r, state[b]), r.shift_rows);
+            state[b] = _mm_xor_si128(vperm_mix_columns(r, state[b]), round_keys[round]);
+        }
+    }
+    for (int b = 0; b < N; b++)
+    {
+        state[b] = _mm_shuffle_epi8(vperm_sub_bytes(r, state[b]), r.shift_rows);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out) + b, _mm_xor_si128(state[b], round_keys[Nr]));
+    }
+}
+
+/**
+ * Performs Key Expansion with SubWord on vperm_sub_bytes, so no memory access depends on the key.
+ * Fills schedule with the same bytes as ExpandKey
+ * */
+template <int Nk, int Nr = Nk + 6>
+SSSE3_TARGET void ExpandKey_VPerm(uint8_t const *cipher_key, uint8_t *schedule)
+{
+    static_assert((Nk == 4 || Nk == 6 || Nk == 8) && Nr == Nk + 6, "AES-128, AES-192 or AES-256");
+    VPermRegisters r = vperm_load_registers();
+    std::memcpy(schedule, cipher_key, 4 * Nk);
+    for (int i = Nk; i < Nb * (Nr + 1); i++)
+    {
+        uint8_t temp_word[4];
+        std::memcpy(temp_word, schedule + 4 * (i - 1), 4);
+        if (i % Nk == 0)
+        {
+            // RotWord as a shuffle, then SubWord on the low 4 bytes of the register
+            __m128i word = _mm_setr_epi8(temp_word[1], temp_word[2], temp_word[3], temp_word[0], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+            int substituted = _mm_cvtsi128_si32(vperm_sub_bytes(r, word));
+            std::memcpy(temp_word, &substituted, 4);
+            temp_word[0] ^= Rcon[(i / Nk) - 1];
+        }
+        else if (Nk > 6 && i % Nk == 4)
+        {
+            // AES-256 substitutes the middle word without rotating it
+            __m128i word = _mm_setr_epi8(temp_word[0], temp_word[1], temp_word[2], temp_word[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+            int substituted = _mm_cvtsi128_si32(vperm_sub_bytes(r, word));
+            std::memcpy(temp_word, &substituted, 4);
+        }
+        for (int j = 0; j < 4; j++)
+        {
+            schedule[4 * i + j] = schedule[4 * (i - Nk) + j] ^ temp_word[j];
+        }
+    }
+}
+
+/**
+ * Encrypts nblocks consecutive blocks (ECB), 4 at a time and then one by one
+ * */
+template <int Nk, int Nr = Nk + 6>
+SSSE3_TARGET void EncryptBlocks_VPerm(uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    VPermRegisters r = vperm_load_registers();
+    __m128i round_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(schedule) + round);
+    }
+
+    size_t i = 0;
+    for (; i + 4 <= nblocks; i += 4)
+    {
+        vperm_cipher<4, Nr>(r, round_keys, in + 16 * i, out + 16 * i);
+    }
+    for (; i < nblocks; i++)
+    {
+        vperm_cipher<1, Nr>(r, round_keys, in + 16 * i, out + 16 * i);
+    }
+}
+
+/**
+ * Decrypts N blocks side by side with the equivalent inverse cipher
+ * */
+template <int N, int Nr>
+SSSE3_TARGET static inline void vperm_inverse_cipher(VPermRegisters const &r, __m128i const *round_keys, uint8_t const *in, uint8_t *out)
+{
+    __m128i state[N];
+    for (int b = 0; b < N; b++)
+    {
+        state[b] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(in) + b), round_keys[0]);
+    }
+    for (int round = 1; round < Nr; round++)
+    {
+        for (int b = 0; b < N; b++)
+        {
+            state[b] = _mm_shuffle_epi8(vperm_inv_sub_bytes(r, state[b]), r.inverse_shift_rows);
+            state[b] = _mm_xor_si128(vperm_inv_mix_columns(r, state[b]), round_keys[round]);
+        }
+    }
+    for (int b = 0; b < N; b++)
+    {
+        state[b] = _mm_shuffle_epi8(vperm_inv_sub_bytes(r, state[b]), r.inverse_shift_rows);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out) + b, _mm_xor_si128(state[b], round_keys[Nr]));
+    }
+}
+
+/**
+ * Decrypts nblocks consecutive blocks (ECB), 4 at a time and then one by one. inverse_schedule is from InvertSchedule
+ * */
+template <int Nk, int Nr = Nk + 6>
+SSSE3_TARGET void DecryptBlocks_VPerm(uint8_t const *inverse_schedule, uint8_t const *in, uint8_t *out, size_t nblocks)
+{
+    VPermRegisters r = vperm_load_registers();
+    __m128i round_keys[Nr + 1];
+    for (int round = 0; round <= Nr; round++)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(inverse_schedule) + round);
+    }
+
+    size_t i = 0;
+    for (; i + 4 <= nblocks; i += 4)
+    {
+        vperm_inverse_cipher<4, Nr>(r, round_keys, in + 16 * i, out + 16 * i);
+    }
+    for (; i < nblocks; i++)
+    {
+        vperm_inverse_cipher<1, Nr>(r, round_keys, in + 16 * i, out + 16 * i);
+    }
+}
+
+#endif
+
+#endif
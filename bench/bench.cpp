@@ -0,0 +1,498 @@
+// Microbenchmarks. Run all of them with `make bench`, or one group with ./bench/bench.out <group>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+#include "../aes.cpp"
+
+// Keeps the compiler from dropping the work that is being timed
+static volatile uint32_t sink;
+
+/**
+ * Runs function until at least min_seconds have passed and returns the nanoseconds per call
+ * */
+template <typename Function>
+static double time_per_call(Function function, double min_seconds = 0.2)
+{
+    typedef std::chrono::steady_clock Clock;
+    size_t calls = 1;
+    while (true)
+    {
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < calls; i++)
+        {
+            function();
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (elapsed >= min_seconds)
+        {
+            return elapsed * 1e9 / calls;
+        }
+        calls *= 2;
+    }
+}
+
+// ------- MixColumns -------
+
+static const size_t MIX_COLUMNS = 4096;
+
+template <void (*mix)(uint8_t *)>
+static double bench_mix_column(std::vector<uint8_t> &columns)
+{
+    double ns = time_per_call([&]() {
+        for (size_t i = 0; i < MIX_COLUMNS; i++)
+        {
+            mix(&columns[4 * i]);
+        }
+        sink = sink + columns[0];
+    });
+    return ns / MIX_COLUMNS;
+}
+
+template <uint32_t (*mix)(uint32_t)>
+static double bench_mix_column(std::vector<uint8_t> &columns)
+{
+    double ns = time_per_call([&]() {
+        for (size_t i = 0; i < MIX_COLUMNS; i++)
+        {
+            uint32_t column;
+            std::memcpy(&column, &columns[4 * i], 4);
+            column = mix(column);
+            std::memcpy(&columns[4 * i], &column, 4);
+        }
+        sink = sink + columns[0];
+    });
+    return ns / MIX_COLUMNS;
+}
+
+/**
+ * Cost of one column of MixColumns and InvMixColumns for each way of multiplying in GF(2^8)
+ * */
+static void bench_mix_columns()
+{
+    std::vector<uint8_t> columns(4 * MIX_COLUMNS);
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+        columns[i] = static_cast<uint8_t>(i * 131 + 7);
+    }
+
+    struct Result
+    {
+        char const *name;
+        double forward, inverse;
+    };
+    Result results[] = {
+        {"multiply_in_GF", bench_mix_column<MixColumn_GF>(columns), bench_mix_column<InvMixColumn_GF>(columns)},
+        {"table", bench_mix_column<MixColumn_Table>(columns), bench_mix_column<InvMixColumn_Table>(columns)},
+        {"xtime", bench_mix_column<MixColumn_XTime>(columns), bench_mix_column<InvMixColumn_XTime>(columns)},
+        {"swar", bench_mix_column<MixColumn_SWAR>(columns), bench_mix_column<InvMixColumn_SWAR>(columns)},
+    };
+
+    std::printf("%-16s %14s %17s\n", "mix column", "ns/column", "inverse ns/column");
+    for (Result const &result : results)
+    {
+        std::printf("%-16s %14.2f %17.2f\n", result.name, result.forward, result.inverse);
+    }
+}
+
+// ------- Interleaved T-table blocks -------
+
+static const size_t INTERLEAVE_BLOCKS = 4096;
+
+/**
+ * Throughput in MB/s of nblocks blocks encrypted by function
+ * */
+template <typename Function>
+static double megabytes_per_second(size_t nblocks, Function function)
+{
+    return 16.0 * nblocks / time_per_call(function) * 1e3;
+}
+
+template <int N>
+static void bench_interleave_factor(uint8_t const *round_keys, std::vector<uint8_t> &in, std::vector<uint8_t> &out)
+{
+    double ecb = megabytes_per_second(INTERLEAVE_BLOCKS, [&]() {
+        EncryptBlocks_TTableInterleaved<N>(round_keys, in.data(), out.data(), INTERLEAVE_BLOCKS);
+        sink = sink + out[0];
+    });
+    // CTR through ctr_crypt, on the T-table backend with N blocks in flight
+    uint8_t cipher_key[16] = {}, iv[16] = {};
+    Backend interleaved = *FindBackend("ttable");
+    interleaved.encrypt_blocks[0] = EncryptBlocks_TTableInterleaved<N>;
+    const Schedule schedule(cipher_key, interleaved);
+    double ctr = megabytes_per_second(INTERLEAVE_BLOCKS, [&]() {
+        ctr_crypt(schedule, iv, 0, in.data(), out.data(), 16 * INTERLEAVE_BLOCKS);
+        sink = sink + out[0];
+    });
+    std::printf("%-16d %10.1f %10.1f\n", N, ecb, ctr);
+}
+
+/**
+ * ECB and CTR throughput of the T-table engine for each number of blocks in flight, on 64 KB (fits in L2)
+ * */
+static void bench_interleave()
+{
+    uint8_t cipher_key[16] = {};
+    uint8_t round_keys[4 * Nb * (Nr + 1)];
+    ExpandKey(cipher_key, round_keys);
+    std::vector<uint8_t> in(16 * INTERLEAVE_BLOCKS, 0x5a), out(16 * INTERLEAVE_BLOCKS);
+
+    std::printf("%-16s %10s %10s\n", "blocks in flight", "ECB MB/s", "CTR MB/s");
+    bench_interleave_factor<1>(round_keys, in, out);
+    bench_interleave_factor<2>(round_keys, in, out);
+    bench_interleave_factor<4>(round_keys, in, out);
+    bench_interleave_factor<8>(round_keys, in, out);
+}
+
+// ------- Decryption -------
+
+/**
+ * Encryption and decryption throughput of every supported backend on 64 KB, AES-128
+ * */
+static void bench_decrypt()
+{
+    uint8_t cipher_key[16] = {};
+    std::vector<uint8_t> in(16 * INTERLEAVE_BLOCKS, 0x5a), out(16 * INTERLEAVE_BLOCKS);
+
+    std::printf("%-16s %10s %10s\n", "backend", "enc MB/s", "dec MB/s");
+    for (size_t b = 0; b < BACKEND_COUNT; b++)
+    {
+        if (!BACKENDS[b].supported())
+        {
+            continue;
+        }
+        const Schedule schedule(cipher_key, BACKENDS[b]);
+        double encrypt = megabytes_per_second(INTERLEAVE_BLOCKS, [&]() {
+            encrypt_blocks(schedule, in.data(), out.data(), INTERLEAVE_BLOCKS);
+            sink = sink + out[0];
+        });
+        double decrypt = megabytes_per_second(INTERLEAVE_BLOCKS, [&]() {
+            decrypt_blocks(schedule, in.data(), out.data(), INTERLEAVE_BLOCKS);
+            sink = sink + out[0];
+        });
+        std::printf("%-16s %10.1f %10.1f\n", BACKENDS[b].name, encrypt, decrypt);
+    }
+}
+
+// ------- CBC -------
+
+/**
+ * CBC throughput of every supported backend on 64 KB, AES-128: one stream encrypted serially,
+ * CBC_LANES streams encrypted side by side, and one stream decrypted
+ * */
+static void bench_cbc()
+{
+    uint8_t cipher_key[16] = {}, iv[16] = {};
+    std::vector<uint8_t> in(16 * INTERLEAVE_BLOCKS, 0x5a), out(16 * INTERLEAVE_BLOCKS);
+    CbcStream streams[CBC_LANES];
+    const size_t stream_blocks = INTERLEAVE_BLOCKS / CBC_LANES;
+    for (size_t s = 0; s < CBC_LANES; s++)
+    {
+        std::memset(streams[s].iv, 0, 16);
+        streams[s].in = in.data() + 16 * stream_blocks * s;
+        streams[s].out = out.data() + 16 * stream_blocks * s;
+        streams[s].nblocks = stream_blocks;
+    }
+
+    std::printf("%-16s %10s %10s %10s\n", "backend", "enc MB/s", "lanes MB/s", "dec MB/s");
+    for (size_t b = 0; b < BACKEND_COUNT; b++)
+    {
+        if (!BACKENDS[b].supported())
+        {
+            continue;
+        }
+        const Schedule schedule(cipher_key, BACKENDS[b]);
+        double serial = megabytes_per_second(INTERLEAVE_BLOCKS, [&]() {
+            cbc_encrypt(schedule, iv, in.data(), out.data(), INTERLEAVE_BLOCKS);
+            sink = sink + out[0];
+        });
+        double lanes = megabytes_per_second(INTERLEAVE_BLOCKS, [&]() {
+            cbc_encrypt_streams(schedule, streams, CBC_LANES);
+            sink = sink + out[0];
+        });
+        double decrypt = megabytes_per_second(INTERLEAVE_BLOCKS, [&]() {
+            cbc_decrypt(schedule, iv, in.data(), out.data(), INTERLEAVE_BLOCKS);
+            sink = sink + out[0];
+        });
+        std::printf("%-16s %10.1f %10.1f %10.1f\n", BACKENDS[b].name, serial, lanes, decrypt);
+    }
+}
+
+// ------- GCM -------
+
+/**
+ * GCM throughput of every supported backend on 64 KB, AES-128, next to plain CTR: the AES-NI backends
+ * run the stitched loop, the others a batch of keystream and then GHASH
+ * */
+static void bench_gcm()
+{
+    uint8_t cipher_key[16] = {}, iv[16] = {}, tag[16];
+    std::vector<uint8_t> in(16 * INTERLEAVE_BLOCKS, 0x5a), out(16 * INTERLEAVE_BLOCKS);
+
+    std::printf("%-16s %10s %10s %10s\n", "backend", "CTR MB/s", "enc MB/s", "dec MB/s");
+    for (size_t b = 0; b < BACKEND_COUNT; b++)
+    {
+        if (!BACKENDS[b].supported())
+        {
+            continue;
+        }
+        const Schedule schedule(cipher_key, BACKENDS[b]);
+        const Gcm gcm(schedule);
+        double ctr = megabytes_per_second(INTERLEAVE_BLOCKS, [&]() {
+            ctr_crypt(schedule, iv, 0, in.data(), out.data(), 16 * INTERLEAVE_BLOCKS);
+            sink = sink + out[0];
+        });
+        double encrypt = megabytes_per_second(INTERLEAVE_BLOCKS, [&]() {
+            gcm.encrypt(iv, 12, nullptr, 0, in.data(), out.data(), 16 * INTERLEAVE_BLOCKS, tag);
+            sink = sink + tag[0];
+        });
+        double decrypt = megabytes_per_second(INTERLEAVE_BLOCKS, [&]() {
+            sink = sink + gcm.decrypt(iv, 12, nullptr, 0, in.data(), out.data(), 16 * INTERLEAVE_BLOCKS, tag);
+        });
+        std::printf("%-16s %10.1f %10.1f %10.1f\n", BACKENDS[b].name, ctr, encrypt, decrypt);
+    }
+}
+
+// ------- Parallel ECB -------
+
+/**
+ * Throughput of encrypt_blocks_parallel and ctr_crypt_parallel on 64 MB for 1, 2, 4, ... threads, up to twice the number of cores
+ * */
+static void bench_parallel()
+{
+    const size_t nblocks = 4 * 1024 * 1024;
+    uint8_t cipher_key[16] = {}, iv[16] = {};
+    const Schedule schedule(cipher_key);
+    std::vector<uint8_t> in(16 * nblocks, 0x5a), out(16 * nblocks);
+
+    unsigned cores = std::thread::hardware_concurrency();
+    std::printf("%-10s %10s %10s   (%s, %u cores)\n", "threads", "ECB MB/s", "CTR MB/s", schedule.backend().name, cores);
+    for (unsigned threads = 1; threads <= 2 * (cores > 0 ? cores : 1); threads *= 2)
+    {
+        ThreadPool pool(threads - 1);
+        double ecb = megabytes_per_second(nblocks, [&]() {
+            encrypt_blocks_parallel(schedule, in.data(), out.data(), nblocks, pool);
+            sink = sink + out[0];
+        });
+        double ctr = megabytes_per_second(nblocks, [&]() {
+            ctr_crypt_parallel(schedule, iv, 0, in.data(), out.data(), 16 * nblocks, pool);
+            sink = sink + out[0];
+        });
+        std::printf("%-10u %10.1f %10.1f\n", threads, ecb, ctr);
+    }
+}
+
+// ------- Output paths -------
+
+/**
+ * Encrypts size bytes in 1 MB chunks and hands every chunk to write, like the streaming mode does
+ * */
+template <typename Write>
+static void encrypt_and_write(Schedule const &schedule, std::vector<uint8_t> const &plaintext, std::vector<uint8_t> &ciphertext,
+                              uint64_t size, Write write)
+{
+    for (uint64_t done = 0; done < size; done += plaintext.size())
+    {
+        size_t chunk = size - done < plaintext.size() ? static_cast<size_t>(size - done) : plaintext.size();
+        encrypt_blocks_parallel(schedule, plaintext.data(), ciphertext.data(), (chunk + 15) / 16);
+        write(ciphertext.data(), chunk);
+    }
+}
+
+/**
+ * End to end encrypt and write to /dev/null, per byte through an ostream like main used to, and with Output
+ * */
+static void bench_output()
+{
+    uint8_t cipher_key[16] = {};
+    const Schedule schedule(cipher_key);
+    std::vector<uint8_t> plaintext(STREAM_CHUNK_SIZE, 0x5a), ciphertext(STREAM_CHUNK_SIZE);
+    std::ofstream null_stream("/dev/null", std::ios::binary);
+    int null_fd = open("/dev/null", O_WRONLY);
+
+    std::printf("%-10s %16s %16s\n", "bytes", "per byte MB/s", "write(2) MB/s");
+    for (uint64_t size = 16; size <= (uint64_t(1) << 30); size *= size < 1024 ? 64 : 16)
+    {
+        // one pass is enough for the large sizes
+        double min_seconds = size >= (uint64_t(1) << 26) ? 0.0 : 0.2;
+        double per_byte = time_per_call([&]() {
+            encrypt_and_write(schedule, plaintext, ciphertext, size, [&](uint8_t const *data, size_t length) {
+                for (size_t i = 0; i < length; i++)
+                {
+                    null_stream << std::hex << data[i];
+                }
+            });
+            null_stream.flush();
+        }, min_seconds);
+        double bulk = time_per_call([&]() {
+            Output out(null_fd);
+            encrypt_and_write(schedule, plaintext, ciphertext, size, [&](uint8_t const *data, size_t length) {
+                out.write(data, length);
+            });
+        }, min_seconds);
+        std::printf("%-10llu %16.1f %16.1f\n", static_cast<unsigned long long>(size), size / per_byte * 1e3, size / bulk * 1e3);
+    }
+    close(null_fd);
+}
+
+// ------- File to file engines -------
+
+/**
+ * Writes size bytes to fd, so the benchmarks read a file that is in the page cache
+ * */
+static bool fill_file(int fd, size_t size)
+{
+    std::vector<uint8_t> chunk(STREAM_CHUNK_SIZE, 0x5a);
+    for (size_t done = 0; done < size; done += chunk.size())
+    {
+        size_t length = size - done < chunk.size() ? size - done : chunk.size();
+        if (write(fd, chunk.data(), length) != static_cast<ssize_t>(length))
+        {
+            std::perror("write");
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Encrypts a 256 MB file (in the page cache) into another with each file engine
+ * */
+static void bench_files()
+{
+    char in_path[] = "/tmp/aes_bench_in_XXXXXX";
+    char out_path[] = "/tmp/aes_bench_out_XXXXXX";
+    int in_fd = mkstemp(in_path);
+    close(mkstemp(out_path));
+    const size_t size = size_t(1) << 28;
+    if (!fill_file(in_fd, KEY_SIZE + size))
+    {
+        return;
+    }
+    uint8_t cipher_key[16] = {};
+    const Schedule schedule(cipher_key);
+
+    std::printf("%-10s %10s\n", "engine", "MB/s");
+    double mmap_ns = time_per_call([&]() { encrypt_file(in_path, out_path); }, 1.0);
+    std::printf("%-10s %10.1f\n", "mmap", size / mmap_ns * 1e3);
+    double uring_ns = time_per_call([&]() { encrypt_file_uring(in_path, out_path); }, 1.0);
+    std::printf("%-10s %10.1f\n", "io_uring", size / uring_ns * 1e3);
+    double pipeline_ns = time_per_call([&]() {
+        int out_fd = open(out_path, O_WRONLY | O_TRUNC);
+        lseek(in_fd, KEY_SIZE, SEEK_SET);
+        encrypt_pipeline(schedule, in_fd, out_fd, std::thread::hardware_concurrency());
+        close(out_fd);
+    }, 1.0);
+    std::printf("%-10s %10.1f\n", "pipeline", size / pipeline_ns * 1e3);
+
+    close(in_fd);
+    unlink(in_path);
+    unlink(out_path);
+}
+
+// ------- Pipe output -------
+
+/**
+ * Runs send(pipe write end) while another thread reads everything from the pipe, returns MB/s for size bytes
+ * */
+template <typename Send>
+static double pipe_megabytes_per_second(uint64_t size, Send send)
+{
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0)
+    {
+        return 0;
+    }
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    std::thread reader([&]() {
+        std::vector<uint8_t> buffer(1 << 16);
+        while (read(pipe_fds[0], buffer.data(), buffer.size()) > 0)
+        {
+        }
+    });
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    send(pipe_fds[1]);
+    close(pipe_fds[1]);
+    reader.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    close(pipe_fds[0]);
+    return size / seconds / 1e6;
+}
+
+/**
+ * Encrypts a 256 MB file (in the page cache) into a pipe that a reader thread drains, with the
+ * streaming mode's Output and write(2), and with encrypt_stream_to_pipe and vmsplice(2)
+ * */
+static void bench_pipe()
+{
+    char in_path[] = "/tmp/aes_bench_pipe_XXXXXX";
+    int in_fd = mkstemp(in_path);
+    const uint64_t size = uint64_t(1) << 28;
+    if (!fill_file(in_fd, size))
+    {
+        return;
+    }
+    close(in_fd);
+    uint8_t cipher_key[16] = {};
+    const Schedule schedule(cipher_key);
+
+    double written = pipe_megabytes_per_second(size, [&](int fd) {
+        std::ifstream in(in_path, std::ios::binary);
+        Output out(fd);
+        encrypt_stream(schedule, in, out);
+        out.flush();
+    });
+    double spliced = pipe_megabytes_per_second(size, [&](int fd) {
+        int file_fd = open(in_path, O_RDONLY);
+        encrypt_stream_to_pipe(schedule, file_fd, fd);
+        close(file_fd);
+    });
+    std::printf("%-10s %10s\n", "output", "MB/s");
+    std::printf("%-10s %10.1f\n", "write", written);
+    std::printf("%-10s %10.1f\n", "vmsplice", spliced);
+    unlink(in_path);
+}
+
+int main(int argc, char const *argv[])
+{
+    std::string group = argc > 1 ? argv[1] : "all";
+    if (group == "all" || group == "mix")
+    {
+        bench_mix_columns();
+    }
+    if (group == "all" || group == "interleave")
+    {
+        bench_interleave();
+    }
+    if (group == "all" || group == "decrypt")
+    {
+        bench_decrypt();
+    }
+    if (group == "all" || group == "cbc")
+    {
+        bench_cbc();
+    }
+    if (group == "all" || group == "gcm")
+    {
+        bench_gcm();
+    }
+    if (group == "all" || group == "parallel")
+    {
+        bench_parallel();
+    }
+    if (group == "all" || group == "output")
+    {
+        bench_output();
+    }
+    if (group == "all" || group == "files")
+    {
+        bench_files();
+    }
+    if (group == "all" || group == "pipe")
+    {
+        bench_pipe();
+    }
+    return 0;
+}
@@ -1,370 +1,302 @@
-#include <iostream>
-#include <fstream>
-
-// Define constants
-
-// given key in the kattis assignment is 16 bytes long
-static const int KEY_SIZE = 16;
-// plaintext is at most 10e6 according to kattis
-static const int PLAINTEXT_SIZE = 16 * 1000000;
-
-// According to the specification: https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.197.pdf
-// Number  of  columns  (32-bit  words)  comprising  the  State.  For  this  standard, Nb = 4.
-static const int Nb = 4;
-// Number  of  32-bit  words  comprising  the  Cipher  Key.  For  this  standard, Nk = 4
-static const int Nk = 4;
-// Number  of  rounds,  which  is  a  function  of  Nk and  Nb (which  is  fixed). For this standard, Nr = 10
-static const int Nr = 10;
-
-// original key
-uint8_t *key = new uint8_t[KEY_SIZE];
-// plaintext
-uint8_t *plaintext = new uint8_t[PLAINTEXT_SIZE];
-
-// round constant word array (found here: https://en.wikipedia.org/wiki/AES_key_schedule)
-static const uint8_t *Rcon = new uint8_t[10]{
-    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
-
-static const uint8_t *S_box = new uint8_t[16 * 16]{
-    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
-    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
-    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
-    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
-    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
-    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
-    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
-    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
-    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
-    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
-    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
-    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
-    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
-    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
-    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
-    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16};
-
-// 11 keys, first key is the original key, then 10 round keys
-uint8_t *key_schedule = new uint8_t[4 * Nb * (Nr + 1)];
+#include "aes.cpp"
 
 /**
- * Prints the given word
+ * Prints the command line options
  * */
-void print_word(uint8_t const *const &word)
+static void usage(char const *program)
 {
-    std::cout << std::hex << static_cast<int>(word[0]) << " " << static_cast<int>(word[1]) << " " << static_cast<int>(word[2]) << " " << static_cast<int>(word[3]) << std::endl;
+    std::cerr << "usage: " << program << " [--key-size BITS] [--stream | --pipeline] < key_and_plaintext > ciphertext" << std::endl
+              << "       " << program << " [--key-size BITS] --in FILE --out FILE [--uring]" << std::endl
+              << "       " << program << " [--key-size BITS] --in-place FILE" << std::endl
+              << "       " << program << " --decrypt [--key-size BITS] [--in FILE --out FILE | --in-place FILE]" << std::endl
+              << "       " << program << " --ctr IV [--offset BYTES] [--key-size BITS] [--in FILE --out FILE]" << std::endl
+              << "       " << program << " --cbc IV [--decrypt] [--key-size BITS] [--in FILE --out FILE]" << std::endl
+              << "       " << program << " --gcm IV [--decrypt] [--key-size BITS]" << std::endl
+              << "  the input is the key followed by the plaintext" << std::endl
+              << "  --key-size BITS      128 (the default), 192 or 256 for AES-128, AES-192 or AES-256" << std::endl
+              << "  --decrypt            the input is the key followed by the ciphertext, whole blocks, and the" << std::endl
+              << "                       output is the plaintext with its padding (not with --stream, --pipeline or --uring)" << std::endl
+              << "  --ctr IV             counter mode from the initial counter block IV (32 hex digits), the output" << std::endl
+              << "                       is as long as the input and decrypting is the same operation" << std::endl
+              << "  --offset BYTES       with --ctr, the position of the input in the stream, to process a slice of it" << std::endl
+              << "  --cbc IV             cipher block chaining from IV (32 hex digits) instead of ECB" << std::endl
+              << "  --gcm IV             authenticated encryption with the 96-bit IV (24 hex digits), the output is" << std::endl
+              << "                       the ciphertext and the 16 byte tag. With --decrypt the input ends with the" << std::endl
+              << "                       tag, and nothing is written if it does not match" << std::endl
+              << "  --stream             encrypt in chunks until the end of the input, with no size limit" << std::endl
+              << "                       (spliced into stdout without a copy when it is a pipe)" << std::endl
+              << "  --pipeline           like --stream, reading, encrypting and writing on separate threads" << std::endl
+              << "  --in FILE --out FILE encrypt FILE into FILE through memory mappings, with no size limit" << std::endl
+              << "  --uring              with --in and --out, read and write through io_uring instead" << std::endl
+              << "  --in-place FILE      replace the plaintext in FILE with the ciphertext, the key stays in front" << std::endl
+              << "  a trailing partial block is padded with zero bytes, except in counter and Galois/counter mode" << std::endl;
 }
 
 /**
- * Prints the given block
+ * Reads size bytes written as 2 * size hex digits, false if text is anything else
  * */
-void print_block(uint8_t const *const &block)
+static bool parse_hex(char const *text, uint8_t *bytes, size_t size)
 {
-    for (int i = 0; i < Nk; i++)
+    if (std::strlen(text) != 2 * size)
     {
-        uint8_t *temp_word = new uint8_t[4]{block[i * 4], block[i * 4 + 1], block[i * 4 + 2], block[i * 4 + 3]};
-        print_word(temp_word);
-        delete[] temp_word;
+        return false;
     }
+    for (size_t i = 0; i < size; i++)
+    {
+        char digits[3] = {text[2 * i], text[2 * i + 1], 0};
+        char *end;
+        bytes[i] = static_cast<uint8_t>(std::strtoul(digits, &end, 16));
+        if (end != digits + 2)
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
 /**
- * Rotates a word left one step
+ * Reads a block written as 32 hex digits, false if text is anything else
  * */
-uint8_t *const &RotWord(uint8_t *const &temp)
+static bool parse_block(char const *text, uint8_t *block)
 {
-    uint8_t t = temp[0];
-    temp[0] = temp[1];
-    temp[1] = temp[2];
-    temp[2] = temp[3];
-    temp[3] = t;
-    return temp;
+    return parse_hex(text, block, 16);
 }
 
-/**
- * Substitutes each value in a word with the corresponding value in the S_box
- * */
-uint8_t *const &SubWord(uint8_t *const &temp)
+int main(int argc, char const *argv[])
 {
-    for (int i = 0; i < Nk; i++)
+    // ------- Parse the options -------
+    bool stream = false;
+    bool pipeline = false;
+    bool uring = false;
+    bool decrypt = false;
+    bool ctr = false;
+    bool cbc = false;
+    bool gcm = false;
+    uint8_t iv[16] = {};
+    uint64_t offset = 0;
+    int key_size = KEY_SIZE;
+    char const *in_path = nullptr;
+    char const *out_path = nullptr;
+    char const *in_place_path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--stream") == 0)
+        {
+            stream = true;
+        }
+        else if (std::strcmp(argv[i], "--pipeline") == 0)
+        {
+            pipeline = true;
+        }
+        else if (std::strcmp(argv[i], "--uring") == 0)
+        {
+            uring = true;
+        }
+        else if (std::strcmp(argv[i], "--decrypt") == 0)
+        {
+            decrypt = true;
+        }
+        else if (std::strcmp(argv[i], "--ctr") == 0 && i + 1 < argc && parse_block(argv[i + 1], iv))
+        {
+            ctr = true;
+            i++;
+        }
+        else if (std::strcmp(argv[i], "--cbc") == 0 && i + 1 < argc && parse_block(argv[i + 1], iv))
+        {
+            cbc = true;
+            i++;
+        }
+        else if (std::strcmp(argv[i], "--gcm") == 0 && i + 1 < argc && parse_hex(argv[i + 1], iv, 12))
+        {
+            gcm = true;
+            i++;
+        }
+        else if (std::strcmp(argv[i], "--offset") == 0 && i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+        {
+            offset = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--key-size") == 0 && i + 1 < argc && key_size_index(std::atoi(argv[i + 1]) / 8) >= 0 &&
+                 std::atoi(argv[i + 1]) % 8 == 0)
+        {
+            key_size = std::atoi(argv[++i]) / 8;
+        }
+        else if (std::strcmp(argv[i], "--in") == 0 && i + 1 < argc)
+        {
+            in_path = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+        {
+            out_path = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--in-place") == 0 && i + 1 < argc)
+        {
+            in_place_path = argv[++i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    int modes = (stream ? 1 : 0) + (pipeline ? 1 : 0) + (in_path != nullptr ? 1 : 0) + (in_place_path != nullptr ? 1 : 0);
+    if ((in_path == nullptr) != (out_path == nullptr) || modes > 1 || (uring && in_path == nullptr) ||
+        (decrypt && (stream || pipeline || uring)) || (ctr && (decrypt || stream || pipeline || uring || in_place_path != nullptr)) ||
+        (offset != 0 && !ctr) || (cbc && (ctr || stream || pipeline || uring || in_place_path != nullptr)) ||
+        (gcm && (ctr || cbc || modes > 0)))
     {
-        uint8_t substituted_val = S_box[temp[i]];
-        temp[i] = substituted_val;
+        usage(argv[0]);
+        return 2;
     }
-    return temp;
-}
-
-/**
- * Performs Key Expansion and fills out the key_schedule with keys for all rounds 
- * */
-void KeyExpansion()
-{
-    uint8_t *temp_word = new uint8_t[Nk];
-
-    int i = 0;
 
-    // first key is the original key
-    // i is the i:th word
-    while (i < Nk)
+    // ------- File mode: encrypt from one mapped file into another -------
+    if (in_path != nullptr && ctr)
     {
-        key_schedule[(i * 4)] = key[i * 4];
-        key_schedule[(i * 4) + 1] = key[(i * 4) + 1];
-        key_schedule[(i * 4) + 2] = key[(i * 4) + 2];
-        key_schedule[(i * 4) + 3] = key[(i * 4) + 3];
-        i++;
+        return ctr_file(in_path, out_path, iv, offset, key_size) ? 0 : 1;
     }
-
-    // Perform the expansion for the 10 round keys
-    i = Nk;
-    while (i < (Nb * (Nr + 1)))
+    if (in_path != nullptr && cbc)
     {
-        temp_word[0] = key_schedule[4 * (i - 1)];
-        temp_word[1] = key_schedule[(4 * (i - 1)) + 1];
-        temp_word[2] = key_schedule[(4 * (i - 1)) + 2];
-        temp_word[3] = key_schedule[(4 * (i - 1)) + 3];
-        if (i % Nk == 0)
-        {
-            // Rotate and substitute the word
-            SubWord(RotWord(temp_word));
-            // xor the word, since only the first element in the round constant is non-zero,
-            // it's enough to xor the first element of temp_word with the the corresponding element in Rcon
-            uint8_t t = temp_word[0];
-            temp_word[0] = t ^ Rcon[(i / Nk) - 1];
-        }
-        key_schedule[4 * i] = key_schedule[(i - Nk) * 4] ^ temp_word[0];
-        key_schedule[(4 * i) + 1] = key_schedule[((i - Nk) * 4) + 1] ^ temp_word[1];
-        key_schedule[(4 * i) + 2] = key_schedule[((i - Nk) * 4) + 2] ^ temp_word[2];
-        key_schedule[(4 * i) + 3] = key_schedule[((i - Nk) * 4) + 3] ^ temp_word[3];
-
-        // go to the next word 
-        i++;
+        return cbc_file(in_path, out_path, iv, decrypt, key_size) ? 0 : 1;
     }
-    delete[] temp_word;
-}
-
-/**
- * xor's the given state with the current round key, column by column
- * */
-void AddRoundKey(uint8_t *const &state, int round_key)
-{
-    for (int i = 0; i < Nk; i++)
+    if (in_path != nullptr && decrypt)
     {
-        state[i] = state[i] ^ key_schedule[(round_key * KEY_SIZE) + (i * 4)];
-        state[i + 4] = state[i + 4] ^ key_schedule[(round_key * KEY_SIZE) + (i * 4) + 1];
-        state[i + 8] = state[i + 8] ^ key_schedule[(round_key * KEY_SIZE) + (i * 4) + 2];
-        state[i + 12] = state[i + 12] ^ key_schedule[(round_key * KEY_SIZE) + (i * 4) + 3];
+        return decrypt_file(in_path, out_path, key_size) ? 0 : 1;
     }
-}
-
-/**
- * Substitutes each value in the given state with its corresponding value in the substitutaion box
- * */
-void SubBytes(uint8_t *const &state)
-{
-    for (int i = 0; i < 4 * Nk; i++)
+    if (in_path != nullptr)
     {
-        state[i] = S_box[state[i]];
+        bool encrypted = uring ? encrypt_file_uring(in_path, out_path, key_size) : encrypt_file(in_path, out_path, key_size);
+        return encrypted ? 0 : 1;
     }
-}
 
-/**
- * Shifts each row 0, 1, 2 or 3 positions to the left.
- *  - row 0, shifts 0 positions to left
- *  - row 1, shifts 1 positions to left
- *  - row 2, shifts 2 positions to left
- *  - row 3, shifts 3 positions to left
- * */
-void ShiftRows(uint8_t *const &state)
-{
-    for (int i = 0; i < Nk; i++)
+    // ------- In-place mode: encrypt a mapped file where it lies -------
+    if (in_place_path != nullptr && decrypt)
     {
-        for (int j = 0; j < i; j++)
-        {
-            uint8_t *word = new uint8_t[4]{
-                state[i * 4],
-                state[i * 4 + 1],
-                state[i * 4 + 2],
-                state[i * 4 + 3]};
-            word = RotWord(word);
-            state[i * 4] = word[0];
-            state[i * 4 + 1] = word[1];
-            state[i * 4 + 2] = word[2];
-            state[i * 4 + 3] = word[3];
-            delete[] word;
-        }
+        return decrypt_file_in_place(in_place_path, key_size) ? 0 : 1;
+    }
+    if (in_place_path != nullptr)
+    {
+        return encrypt_file_in_place(in_place_path, key_size) ? 0 : 1;
     }
-}
 
-/**
- * Multiplies a and b in Galois field GF(2^8). 
- * Based on pseudocode from https://en.wikipedia.org/wiki/Finite_field_arithmetic#Multiplication
- * */
-uint8_t multiply_in_GF(uint8_t a, uint8_t b)
-{
-    uint8_t product = 0;
+    // ------- Read the input -------
+    static uint8_t key[MAX_KEY_SIZE];
 
-    for (int i = 0; i < 8; i++)
+    // ------- Streaming and pipeline modes: encrypt chunk by chunk until the end of the input -------
+    if (stream || pipeline)
     {
-        if (b & 1)
+        // straight from the file descriptor, cin could buffer plaintext that reads from stdin would miss
+        if (read_fully(STDIN_FILENO, key, key_size) != key_size)
         {
-            product = product ^ a;
+            std::cerr << "no key!" << std::endl;
+            return 1;
         }
-        b = b >> 1;
-
-        // carry is the leftmost bit in a
-        uint8_t carry = a & 0x80;
-        a = a << 1;
-        if (carry)
+        const Schedule schedule(key, key_size);
+        if (pipeline)
         {
-            a = a ^ 0x1b;
+            unsigned cores = std::thread::hardware_concurrency();
+            return encrypt_pipeline(schedule, STDIN_FILENO, STDOUT_FILENO, cores > 0 ? cores : 1) ? 0 : 1;
         }
+        if (is_pipe(STDOUT_FILENO))
+        {
+            return encrypt_stream_to_pipe(schedule, STDIN_FILENO, STDOUT_FILENO) ? 0 : 1;
+        }
+        Output out(STDOUT_FILENO);
+        encrypt_stream(schedule, std::cin, out);
+        return out.flush() ? 0 : 1;
     }
-    return product;
-}
-
-/**
- * Mix the columns in the state by performing multiplication in Galois field GF(2^8) 
- * between the state each column and the following matrix
- * 
- * 02 03 01 01 
- * 01 02 03 01 
- * 01 01 02 03
- * 03 01 01 02
- * 
- * */
-void MixColumns(uint8_t *const &state)
-{
-    for (int i = 0; i < Nk; i++)
-    {
-        uint8_t s0 = multiply_in_GF(state[i], 0x02) ^ multiply_in_GF(state[i + 4], 0x03) ^ state[i + 8] ^ state[i + 12];
-        uint8_t s1 = state[i] ^ multiply_in_GF(state[i + 4], 0x02) ^ multiply_in_GF(state[i + 8], 0x03) ^ state[i + 12];
-        uint8_t s2 = state[i] ^ state[i + 4] ^ multiply_in_GF(state[i + 8], 0x02) ^ multiply_in_GF(state[i + 12], 0x03);
-        uint8_t s3 = multiply_in_GF(state[i], 0x03) ^ state[i + 4] ^ state[i + 8] ^ multiply_in_GF(state[i + 12], 0x02);
-
-        state[i] = s0;
-        state[i + 4] = s1;
-        state[i + 8] = s2;
-        state[i + 12] = s3;
-    }
-}
-
-/**
- * Transpose the given block
- * Assumes the input is a 4 * 4 matrix
- * */
-uint8_t *Transpose(uint8_t const *const &block)
-{
-    uint8_t *transpose = new uint8_t[16];
-
-    transpose[0] = block[0];
-    transpose[1] = block[4];
-    transpose[2] = block[8];
-    transpose[3] = block[12];
-
-    transpose[4] = block[1];
-    transpose[5] = block[5];
-    transpose[6] = block[9];
-    transpose[7] = block[13];
-
-    transpose[8] = block[2];
-    transpose[9] = block[6];
-    transpose[10] = block[10];
-    transpose[11] = block[14];
-
-    transpose[12] = block[3];
-    transpose[13] = block[7];
-    transpose[14] = block[11];
-    transpose[15] = block[15];
-
-    return transpose;
-}
-
-/**
- * Takes a block as input, encrypts it and returns the ciphertext 
- * */
-uint8_t *Cipher(uint8_t *in)
-{
-    uint8_t *state = Transpose(in);
 
-    AddRoundKey(state, 0);
+    // read() is the binary input function for istream (cin is istream)
+    // the key and the plaintext are read straight into their buffers
+    std::cin.read(reinterpret_cast<char *>(key), key_size);
+    int size = std::cin.gcount();
 
-    for (int i = 1; i < Nr; i++)
+    static uint8_t plaintext[PLAINTEXT_SIZE];
+    if (size == key_size)
     {
-        SubBytes(state);
-        ShiftRows(state);
-        MixColumns(state);
-        AddRoundKey(state, i);
+        std::cin.read(reinterpret_cast<char *>(plaintext), PLAINTEXT_SIZE);
+        size += std::cin.gcount();
     }
 
-    SubBytes(state);
-    ShiftRows(state);
-    AddRoundKey(state, Nr);
-    return state;
-}
-
-int main(int argc, char const *argv[])
-{
-
-    // ------- Read the input -------
-    char *buf = new char[KEY_SIZE + PLAINTEXT_SIZE];
-
-    // read() is the binary input function for istream (cin is istream)
-    std::cin.read(buf, KEY_SIZE + PLAINTEXT_SIZE);
-    int size = std::cin.gcount();
-
     if (size == 0)
         std::cerr
             << "no input!" << std::endl;
 
-    uint8_t *data = (uint8_t *)buf;
-
-    // ------- Populate the plaintext & key variables -------
+    // ------- Expand the key -------
+    const Schedule schedule(key, key_size);
 
-    for (int i = 0; i < KEY_SIZE; i++)
+    // ------- Galois/counter mode: the text is not padded and the tag follows the ciphertext -------
+    if (gcm)
     {
-        key[i] = data[i];
+        // the tag covers the whole message, so it cannot be cut at the end of the buffer
+        if (size == key_size + PLAINTEXT_SIZE && std::cin.peek() != std::char_traits<char>::eof())
+        {
+            std::cerr << "the input is longer than " << PLAINTEXT_SIZE << " bytes, the most --gcm reads" << std::endl;
+            return 1;
+        }
+        const Gcm authenticator(schedule);
+        int text_size = size > key_size ? size - key_size : 0;
+        Output out(STDOUT_FILENO);
+        if (decrypt)
+        {
+            if (text_size < 16)
+            {
+                std::cerr << "the input has no tag" << std::endl;
+                return 1;
+            }
+            text_size -= 16;
+            if (!authenticator.decrypt(iv, 12, nullptr, 0, plaintext, plaintext, text_size, plaintext + text_size))
+            {
+                std::cerr << "authentication failed" << std::endl;
+                return 1;
+            }
+            out.write(plaintext, text_size);
+        }
+        else
+        {
+            uint8_t tag[16];
+            authenticator.encrypt(iv, 12, nullptr, 0, plaintext, plaintext, text_size, tag);
+            out.write(plaintext, text_size);
+            out.write(tag, 16);
+        }
+        return out.flush() ? 0 : 1;
     }
-    for (int i = KEY_SIZE; i < size; i++)
+
+    // ------- Encrypt each block in place and write the result -------
+    // a trailing partial block is encrypted with the zero bytes that follow it in the buffer
+    int plaintext_size = size > key_size ? (size - key_size + 15) / 16 * 16 : 0;
+    if (ctr)
     {
-        plaintext[i - KEY_SIZE] = data[i];
+        // counter mode needs no padding
+        plaintext_size = size > key_size ? size - key_size : 0;
+        ctr_crypt_parallel(schedule, iv, offset, plaintext, plaintext, plaintext_size);
     }
-
-    delete[] data;
-
-    // ------- Expand the key -------
-    KeyExpansion();
-
-    // ------- Encrypt each block and save the result -------
-    uint8_t *result = new uint8_t[size - KEY_SIZE];
-
-    for (int i = 0; i < (size - KEY_SIZE) / 16; i++)
+    else if (decrypt)
     {
-        uint8_t *block = new uint8_t[16];
-        for (int j = 0; j < 16; j++)
+        // here the buffer holds the ciphertext, which must be whole blocks
+        if (size > key_size && (size - key_size) % 16 != 0)
+        {
+            std::cerr << "the ciphertext is not whole blocks" << std::endl;
+            return 1;
+        }
+        if (cbc)
         {
-            block[j] = plaintext[i * 16 + j];
+            cbc_decrypt_parallel(schedule, iv, plaintext, plaintext, plaintext_size / 16);
         }
-        uint8_t *temp = Cipher(block);
-        uint8_t *cipher = Transpose(temp);
-        for (int j = 0; j < 16; j++)
+        else
         {
-            result[i * 16 + j] = cipher[j];
+            decrypt_blocks_parallel(schedule, plaintext, plaintext, plaintext_size / 16);
         }
-        delete[] temp;
-        delete[] block;
-        delete[] cipher;
     }
-
-    for (int i = 0; i < size - KEY_SIZE; i++)
+    else if (cbc)
+    {
+        cbc_encrypt(schedule, iv, plaintext, plaintext, plaintext_size / 16);
+    }
+    else
     {
-        std::cout << std::hex << result[i];
+        encrypt_blocks_parallel(schedule, plaintext, plaintext, plaintext_size / 16);
     }
 
-    delete[] result;
-    delete[] key;
-    delete[] key_schedule;
-    delete[] plaintext;
-    delete[] Rcon;
-    delete[] S_box;
+    Output out(STDOUT_FILENO);
+    out.write(plaintext, plaintext_size);
 
-    return 0;
+    return out.flush() ? 0 : 1;
 }
\ No newline at end of file
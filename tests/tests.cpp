@@ -1,6 +1,37 @@
 #define CATCH_CONFIG_MAIN // This tells Catch to provide a main() - only do this in one cpp file
+#define CATCH_CONFIG_NO_POSIX_SIGNALS // the bundled catch.hpp does not build its signal handler against newer glibc
 #include "catch.hpp"
-#include "aes.cpp"
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include "../aes.cpp"
+
+// Counts every heap allocation in the process, for the "Zero allocations" test
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+    std::free(memory);
+}
+
+// The cipher key of FIPS-197 Appendix C.1
+static uint8_t const fips_key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
 
 // TEST_CASE("RotWord")
 // {
@@ -175,19 +206,19 @@
 //     print_block(state);
 //     // transpose the plaintext matrix as input
 //     std::cout << "------------- START -------------" << std::endl;
-//     AddRoundKey(state, 0);
+//     AddRoundKey(state, key_schedule, 0);
 //     print_block(state);
 //     for (int i = 1; i < Nr; i++)
 //     {
 //         SubBytes(state);
 //         ShiftRows(state);
 //         MixColumns(state);
-//         AddRoundKey(state, i);
+//         AddRoundKey(state, key_schedule, i);
 //     }
 
 //     SubBytes(state);
 //     ShiftRows(state);
-//     AddRoundKey(state, Nr);
+//     AddRoundKey(state, key_schedule, Nr);
 
 //     std::cout << "------------- RESULT -------------" << std::endl;
 //     print_block(state);
@@ -246,19 +277,19 @@
 //     print_block(state);
 //     // transpose the plaintext matrix as input
 //     std::cout << "------------- START -------------" << std::endl;
-//     AddRoundKey(state, 0);
+//     AddRoundKey(state, key_schedule, 0);
 //     print_block(state);
 //     for (int i = 1; i < Nr; i++)
 //     {
 //         SubBytes(state);
 //         ShiftRows(state);
 //         MixColumns(state);
-//         AddRoundKey(state, i);
+//         AddRoundKey(state, key_schedule, i);
 //     }
 
 //     SubBytes(state);
 //     ShiftRows(state);
-//     AddRoundKey(state, Nr);
+//     AddRoundKey(state, key_schedule, Nr);
 
 //     std::cout << "------------- RESULT -------------" << std::endl;
 //     print_block(state);
@@ -266,6 +297,9 @@
 
 TEST_CASE("Cipher3")
 {
+    uint8_t key[KEY_SIZE];
+    uint8_t plaintext[16];
+    uint8_t key_schedule[4 * Nb * (Nr + 1)];
 
     key[0] = 0xF4;
     key[1] = 0xC0;
@@ -289,7 +323,7 @@ TEST_CASE("Cipher3")
 
     print_block(key);
 
-    KeyExpansion();
+    ExpandKey(key, key_schedule);
 
     plaintext[0] = 0xF2;
     plaintext[1] = 0x95;
@@ -313,26 +347,1183 @@ TEST_CASE("Cipher3")
     std::cout << "------------- plaintext -------------" << std::endl;
 
     print_block(plaintext);
-    uint8_t *state = Transpose(plaintext);
+    // the state is in the order of the input block
+    uint8_t state[16];
+    for (int i = 0; i < 16; i++)
+    {
+        state[i] = plaintext[i];
+    }
     std::cout << "------------- start state -------------" << std::endl;
 
     print_block(state);
-    // transpose the plaintext matrix as input
     std::cout << "------------- START -------------" << std::endl;
-    AddRoundKey(state, 0);
+    AddRoundKey(state, key_schedule, 0);
     print_block(state);
     for (int i = 1; i < Nr; i++)
     {
         SubBytes(state);
         ShiftRows(state);
         MixColumns(state);
-        AddRoundKey(state, i);
+        AddRoundKey(state, key_schedule, i);
     }
 
     SubBytes(state);
     ShiftRows(state);
-    AddRoundKey(state, Nr);
+    AddRoundKey(state, key_schedule, Nr);
 
     std::cout << "------------- RESULT -------------" << std::endl;
     print_block(state);
-}
\ No newline at end of file
+
+    uint8_t expected[16];
+    Cipher_TTable(key_schedule, plaintext, expected);
+    for (int i = 0; i < 16; i++)
+    {
+        REQUIRE(expected[i] == state[i]);
+    }
+}
+TEST_CASE("Cipher_TTable")
+{
+    // Test case from https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.197.pdf (page: 35, Appendix C.1)
+    uint8_t const input[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+    uint8_t const expected[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+
+    uint8_t key_schedule[4 * Nb * (Nr + 1)];
+    ExpandKey(fips_key, key_schedule);
+
+    uint8_t output[16];
+    Cipher_TTable(key_schedule, input, output);
+    for (int i = 0; i < 16; i++)
+    {
+        REQUIRE(expected[i] == output[i]);
+    }
+
+    uint8_t reference[16];
+    Cipher(key_schedule, input, reference);
+    for (int i = 0; i < 16; i++)
+    {
+        REQUIRE(reference[i] == output[i]);
+    }
+}
+
+TEST_CASE("Lookup tables")
+{
+    for (int x = 0; x < 256; x++)
+    {
+        uint8_t b = static_cast<uint8_t>(x);
+        REQUIRE(InvS_box[S_box[b]] == b);
+        REQUIRE(Mul_02[b] == multiply_in_GF(b, 0x02));
+        REQUIRE(Mul_03[b] == multiply_in_GF(b, 0x03));
+        REQUIRE(Mul_09[b] == multiply_in_GF(b, 0x09));
+        REQUIRE(Mul_0b[b] == multiply_in_GF(b, 0x0b));
+        REQUIRE(Mul_0d[b] == multiply_in_GF(b, 0x0d));
+        REQUIRE(Mul_0e[b] == multiply_in_GF(b, 0x0e));
+        if (b != 0)
+        {
+            REQUIRE(multiply_in_GF(b, inverse_in_GF(b)) == 1);
+        }
+    }
+    REQUIRE(reinterpret_cast<uintptr_t>(&S_box) % 64 == 0);
+    REQUIRE(reinterpret_cast<uintptr_t>(&Te0) % 64 == 0);
+}
+
+TEST_CASE("MixColumn variants")
+{
+    for (int x = 0; x < 256; x++)
+    {
+        // a few columns per byte value, so every byte shows up in every row
+        uint8_t const columns[3][4] = {
+            {static_cast<uint8_t>(x), static_cast<uint8_t>(x * 3), static_cast<uint8_t>(x * 7 + 1), static_cast<uint8_t>(~x)},
+            {static_cast<uint8_t>(x * 5 + 9), static_cast<uint8_t>(x), static_cast<uint8_t>(x ^ 0x5a), static_cast<uint8_t>(x * 11)},
+            {static_cast<uint8_t>(x * 13), static_cast<uint8_t>(x + 128), static_cast<uint8_t>(x), static_cast<uint8_t>(x)}};
+        for (auto const &column : columns)
+        {
+            uint8_t expected[4], table[4], xtime_column[4];
+            std::memcpy(expected, column, 4);
+            std::memcpy(table, column, 4);
+            std::memcpy(xtime_column, column, 4);
+            uint32_t word = column[0] | (column[1] << 8) | (column[2] << 16) | (static_cast<uint32_t>(column[3]) << 24);
+
+            MixColumn_GF(expected);
+            MixColumn_Table(table);
+            MixColumn_XTime(xtime_column);
+            uint32_t mixed = MixColumn_SWAR(word);
+            for (int k = 0; k < 4; k++)
+            {
+                REQUIRE(table[k] == expected[k]);
+                REQUIRE(xtime_column[k] == expected[k]);
+                REQUIRE(static_cast<uint8_t>(mixed >> (8 * k)) == expected[k]);
+            }
+
+            // and back again
+            InvMixColumn_GF(expected);
+            InvMixColumn_Table(table);
+            InvMixColumn_XTime(xtime_column);
+            REQUIRE(InvMixColumn_SWAR(mixed) == word);
+            for (int k = 0; k < 4; k++)
+            {
+                REQUIRE(expected[k] == column[k]);
+                REQUIRE(table[k] == column[k]);
+                REQUIRE(xtime_column[k] == column[k]);
+            }
+        }
+    }
+}
+
+template <int N>
+static void check_interleaved_ttable()
+{
+    INFO("interleave " << N);
+    uint8_t schedule[4 * Nb * (Nr + 1)];
+    ExpandKey(fips_key, schedule);
+
+    const size_t nblocks = 19;
+    uint8_t input[nblocks * 16], expected[nblocks * 16], output[nblocks * 16];
+    for (size_t i = 0; i < sizeof(input); i++)
+    {
+        input[i] = static_cast<uint8_t>(i * 5 + 1);
+    }
+    for (size_t b = 0; b < nblocks; b++)
+    {
+        Cipher_TTable(schedule, input + 16 * b, expected + 16 * b);
+    }
+    EncryptBlocks_TTableInterleaved<N>(schedule, input, output, nblocks);
+    for (size_t i = 0; i < sizeof(output); i++)
+    {
+        REQUIRE(expected[i] == output[i]);
+    }
+
+    // CTR example from https://nvlpubs.nist.gov/nistpubs/Legacy/SP/nistspecialpublication800-38a.pdf (F.5.1),
+    // the low byte of the counter wraps around after the first block
+    uint8_t const ctr_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    uint8_t const plaintext_blocks[64] = {
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+        0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+        0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+        0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+    uint8_t const ciphertext_blocks[64] = {
+        0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+        0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+        0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+        0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee};
+    uint8_t const counter[16] = {0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff};
+    // the T-table backend with N blocks in flight, under the shared CTR code
+    Backend interleaved = *FindBackend("ttable");
+    interleaved.encrypt_blocks[0] = EncryptBlocks_TTableInterleaved<N>;
+    const Schedule ctr_schedule(ctr_key, interleaved);
+    uint8_t ctr_output[64];
+    ctr_crypt(ctr_schedule, counter, 0, plaintext_blocks, ctr_output, 64);
+    for (int i = 0; i < 64; i++)
+    {
+        REQUIRE(ciphertext_blocks[i] == ctr_output[i]);
+    }
+}
+
+TEST_CASE("Interleaved T-tables")
+{
+    check_interleaved_ttable<1>();
+    check_interleaved_ttable<2>();
+    check_interleaved_ttable<4>();
+    check_interleaved_ttable<8>();
+}
+
+TEST_CASE("Backends")
+{
+    // FIPS-197 appendix C keys, the first 16, 24 or 32 bytes
+    uint8_t fips_key[32];
+    for (int i = 0; i < 32; i++)
+    {
+        fips_key[i] = static_cast<uint8_t>(i);
+    }
+    const ExpandKeyFunction reference_expand_key[KEY_SIZE_COUNT] = FOR_EACH_KEY_SIZE(ExpandKey);
+    const EncryptBlocksFunction reference_encrypt_blocks[KEY_SIZE_COUNT] = FOR_EACH_KEY_SIZE(EncryptBlocks_TTable);
+
+    // enough blocks to fill the wide loops and leave a tail
+    const size_t nblocks = 77;
+    uint8_t input[nblocks * 16];
+    for (size_t i = 0; i < sizeof(input); i++)
+    {
+        input[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    for (int k = 0; k < KEY_SIZE_COUNT; k++)
+    {
+        INFO("key size " << KEY_SIZES[k]);
+        uint8_t reference_schedule[4 * Nb * (MAX_Nr + 1)] = {};
+        reference_expand_key[k](fips_key, reference_schedule);
+        uint8_t expected[nblocks * 16];
+        reference_encrypt_blocks[k](reference_schedule, input, expected, nblocks);
+
+        for (size_t b = 0; b < BACKEND_COUNT; b++)
+        {
+            Backend const &backend = BACKENDS[b];
+            if (!backend.supported())
+            {
+                continue;
+            }
+            INFO("backend " << backend.name);
+
+            uint8_t schedule[4 * Nb * (MAX_Nr + 1)] = {};
+            backend.expand_key[k](fips_key, schedule);
+            for (size_t i = 0; i < sizeof(schedule); i++)
+            {
+                REQUIRE(reference_schedule[i] == schedule[i]);
+            }
+
+            for (size_t n = 0; n <= nblocks; n += 11)
+            {
+                uint8_t output[nblocks * 16] = {};
+                backend.encrypt_blocks[k](schedule, input, output, n);
+                for (size_t i = 0; i < n * 16; i++)
+                {
+                    REQUIRE(expected[i] == output[i]);
+                }
+
+                // in place
+                std::copy(input, input + sizeof(input), output);
+                backend.encrypt_blocks[k](schedule, output, output, n);
+                for (size_t i = 0; i < n * 16; i++)
+                {
+                    REQUIRE(expected[i] == output[i]);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("AES-192 and AES-256")
+{
+    uint8_t key[32];
+    for (int i = 0; i < 32; i++)
+    {
+        key[i] = static_cast<uint8_t>(i);
+    }
+    uint8_t const plaintext[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+
+    // FIPS-197 appendix A.2 and A.3, the last word of each expanded key
+    uint8_t schedule[4 * Nb * (MAX_Nr + 1)];
+    uint8_t const cipher_key_192[24] = {0x8e, 0x73, 0xb0, 0xf7, 0xda, 0x0e, 0x64, 0x52, 0xc8, 0x10, 0xf3, 0x2b,
+                                        0x80, 0x90, 0x79, 0xe5, 0x62, 0xf8, 0xea, 0xd2, 0x52, 0x2c, 0x6b, 0x7b};
+    ExpandKey<6>(cipher_key_192, schedule);
+    REQUIRE(load_word(schedule + 4 * 51) == 0x01002202);
+    uint8_t const cipher_key_256[32] = {0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+                                        0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4};
+    ExpandKey<8>(cipher_key_256, schedule);
+    REQUIRE(load_word(schedule + 4 * 59) == 0x706c631e);
+
+    // FIPS-197 appendix C.2 and C.3
+    uint8_t const expected_192[16] = {0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0, 0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91};
+    uint8_t const expected_256[16] = {0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89};
+    uint8_t output[16];
+    ExpandKey<6>(key, schedule);
+    Cipher<6>(schedule, plaintext, output);
+    REQUIRE(std::equal(output, output + 16, expected_192));
+    ExpandKey<8>(key, schedule);
+    Cipher<8>(schedule, plaintext, output);
+    REQUIRE(std::equal(output, output + 16, expected_256));
+
+    // and through a Schedule with the selected backend
+    REQUIRE(key_size_index(20) == -1);
+    const Schedule schedule_192(key, 24), schedule_256(key, 32);
+    REQUIRE(schedule_256.key_size() == 32);
+    encrypt_blocks(schedule_192, plaintext, output, 1);
+    REQUIRE(std::equal(output, output + 16, expected_192));
+    encrypt_blocks(schedule_256, plaintext, output, 1);
+    REQUIRE(std::equal(output, output + 16, expected_256));
+}
+
+TEST_CASE("Decryption")
+{
+    uint8_t key[32];
+    for (int i = 0; i < 32; i++)
+    {
+        key[i] = static_cast<uint8_t>(i);
+    }
+    uint8_t const plaintext[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+
+    // FIPS-197 appendix C.1 to C.3, the inverse cipher and the equivalent inverse cipher
+    uint8_t const ciphertexts[KEY_SIZE_COUNT][16] = {
+        {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a},
+        {0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0, 0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91},
+        {0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89}};
+    const ExpandKeyFunction reference_expand_key[KEY_SIZE_COUNT] = FOR_EACH_KEY_SIZE(ExpandKey);
+    const EncryptBlocksFunction reference_encrypt_blocks[KEY_SIZE_COUNT] = FOR_EACH_KEY_SIZE(EncryptBlocks_TTable);
+    const EncryptBlocksFunction inverse_ciphers[KEY_SIZE_COUNT] = {
+        [](uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t) { InvCipher<4>(schedule, in, out); },
+        [](uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t) { InvCipher<6>(schedule, in, out); },
+        [](uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t) { InvCipher<8>(schedule, in, out); }};
+    const InvertScheduleFunction reference_invert_schedule[KEY_SIZE_COUNT] = FOR_EACH_KEY_SIZE(InvertSchedule);
+    const DecryptBlocksFunction equivalent_inverse_ciphers[KEY_SIZE_COUNT] = {
+        [](uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t) { EqInvCipher<4>(schedule, in, out); },
+        [](uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t) { EqInvCipher<6>(schedule, in, out); },
+        [](uint8_t const *schedule, uint8_t const *in, uint8_t *out, size_t) { EqInvCipher<8>(schedule, in, out); }};
+
+    // enough blocks to fill the wide loops and leave a tail
+    const size_t nblocks = 77;
+    uint8_t input[nblocks * 16];
+    for (size_t i = 0; i < sizeof(input); i++)
+    {
+        input[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    for (int k = 0; k < KEY_SIZE_COUNT; k++)
+    {
+        INFO("key size " << KEY_SIZES[k]);
+        uint8_t schedule[4 * Nb * (MAX_Nr + 1)] = {}, reference_inverse_schedule[4 * Nb * (MAX_Nr + 1)] = {};
+        reference_expand_key[k](key, schedule);
+        reference_invert_schedule[k](schedule, reference_inverse_schedule);
+        uint8_t output[16];
+        inverse_ciphers[k](schedule, ciphertexts[k], output, 1);
+        REQUIRE(std::equal(output, output + 16, plaintext));
+        equivalent_inverse_ciphers[k](reference_inverse_schedule, ciphertexts[k], output, 1);
+        REQUIRE(std::equal(output, output + 16, plaintext));
+
+        uint8_t ciphertext[nblocks * 16];
+        reference_encrypt_blocks[k](schedule, input, ciphertext, nblocks);
+
+        for (size_t b = 0; b < BACKEND_COUNT; b++)
+        {
+            Backend const &backend = BACKENDS[b];
+            if (!backend.supported())
+            {
+                continue;
+            }
+            INFO("backend " << backend.name);
+
+            uint8_t inverse_schedule[4 * Nb * (MAX_Nr + 1)] = {};
+            backend.invert_schedule[k](schedule, inverse_schedule);
+            for (size_t i = 0; i < sizeof(inverse_schedule); i++)
+            {
+                REQUIRE(reference_inverse_schedule[i] == inverse_schedule[i]);
+            }
+
+            for (size_t n = 0; n <= nblocks; n += 11)
+            {
+                uint8_t decrypted[nblocks * 16] = {};
+                backend.decrypt_blocks[k](inverse_schedule, ciphertext, decrypted, n);
+                for (size_t i = 0; i < n * 16; i++)
+                {
+                    REQUIRE(input[i] == decrypted[i]);
+                }
+
+                // in place
+                std::copy(ciphertext, ciphertext + sizeof(ciphertext), decrypted);
+                backend.decrypt_blocks[k](inverse_schedule, decrypted, decrypted, n);
+                for (size_t i = 0; i < n * 16; i++)
+                {
+                    REQUIRE(input[i] == decrypted[i]);
+                }
+            }
+        }
+
+        // a Schedule keeps the inverse schedule, and decrypts on the pool too
+        const Schedule cached(key, KEY_SIZES[k]);
+        REQUIRE(std::equal(reference_inverse_schedule, reference_inverse_schedule + 16 * (k * 2 + 11), cached.inverse_round_keys()));
+        std::vector<uint8_t> data(16 * (PARALLEL_MIN_BLOCKS + 3));
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            data[i] = static_cast<uint8_t>(i * 5 + (i >> 9));
+        }
+        std::vector<uint8_t> round_trip(data.size());
+        encrypt_blocks_parallel(cached, data.data(), round_trip.data(), data.size() / 16);
+        REQUIRE(round_trip != data);
+        decrypt_blocks_parallel(cached, round_trip.data(), round_trip.data(), data.size() / 16);
+        REQUIRE(round_trip == data);
+    }
+}
+
+TEST_CASE("CTR")
+{
+    // NIST SP 800-38A F.5.1, CTR-AES128.Encrypt
+    uint8_t const key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    uint8_t const iv[16] = {0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff};
+    uint8_t const plaintext[64] = {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+                                   0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+                                   0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+                                   0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+    uint8_t const ciphertext[64] = {0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+                                    0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+                                    0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+                                    0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee};
+    const Schedule schedule(key);
+    uint8_t output[64];
+    ctr_crypt(schedule, iv, 0, plaintext, output, 64);
+    REQUIRE(std::equal(output, output + 64, ciphertext));
+    ctr_crypt(schedule, iv, 0, output, output, 64);
+    REQUIRE(std::equal(output, output + 64, plaintext));
+
+    // a counter that carries out of the low 64 bits after 16 blocks
+    uint8_t carry_iv[16], counter[16], expected_counter[16];
+    std::copy(iv, iv + 8, carry_iv);
+    std::fill(carry_iv + 8, carry_iv + 16, 0xff);
+    carry_iv[15] = 0xf0;
+    std::copy(carry_iv, carry_iv + 16, expected_counter);
+    // one at a time, with the carry rippling through all 16 bytes
+    for (int i = 0; i < 300; i++)
+    {
+        for (int byte = 15; byte >= 0 && ++expected_counter[byte] == 0; byte--)
+        {
+        }
+    }
+    ctr_counter_at(carry_iv, 300, counter);
+    REQUIRE(std::equal(counter, counter + 16, expected_counter));
+    REQUIRE(counter[7] == 0xf8);
+
+    // every slice of a stream, at any offset and of any length, matches the whole stream
+    std::vector<uint8_t> text(1000), stream(1000);
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        text[i] = static_cast<uint8_t>(i * 13 + 1);
+    }
+    ctr_crypt(schedule, carry_iv, 0, text.data(), stream.data(), text.size());
+    // the keystream of block b is E(iv + b), also across the 64-bit carry
+    for (size_t b = 0; b < text.size() / 16; b++)
+    {
+        uint8_t block_counter[16], keystream[16];
+        ctr_counter_at(carry_iv, b, block_counter);
+        Cipher(schedule.round_keys(), block_counter, keystream);
+        for (int i = 0; i < 16; i++)
+        {
+            REQUIRE((text[16 * b + i] ^ keystream[i]) == stream[16 * b + i]);
+        }
+    }
+    for (size_t offset : {0, 1, 15, 16, 17, 200, 999})
+    {
+        for (size_t length : {0, 1, 15, 16, 33, 500})
+        {
+            INFO("offset " << offset << " length " << length);
+            length = std::min(length, text.size() - offset);
+            std::vector<uint8_t> slice(length);
+            ctr_crypt(schedule, carry_iv, offset, text.data() + offset, slice.data(), length);
+            REQUIRE(std::equal(slice.begin(), slice.end(), stream.begin() + offset));
+        }
+    }
+
+    // on the pool, with an offset that is not on a block boundary
+    const size_t size = PARALLEL_MIN_BLOCKS * 16 + 1000;
+    std::vector<uint8_t> big(size), expected(size), parallel(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        big[i] = static_cast<uint8_t>(i * 7 + (i >> 10));
+    }
+    ThreadPool pool(3);
+    for (uint64_t offset : {static_cast<uint64_t>(0), static_cast<uint64_t>(5), static_cast<uint64_t>(1) << 40})
+    {
+        INFO("offset " << offset);
+        ctr_crypt(schedule, iv, offset, big.data(), expected.data(), size - 3);
+        ctr_crypt_parallel(schedule, iv, offset, big.data(), parallel.data(), size - 3, pool);
+        REQUIRE(std::equal(expected.begin(), expected.end() - 3, parallel.begin()));
+    }
+}
+
+TEST_CASE("CBC")
+{
+    // NIST SP 800-38A F.2.1, CBC-AES128.Encrypt
+    uint8_t const key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    uint8_t const iv[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+    uint8_t const plaintext[64] = {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+                                   0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+                                   0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+                                   0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+    uint8_t const ciphertext[64] = {0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+                                    0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+                                    0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+                                    0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7};
+    const Schedule schedule(key);
+    uint8_t output[64], chain[16];
+    std::copy(iv, iv + 16, chain);
+    cbc_encrypt(schedule, chain, plaintext, output, 64 / 16);
+    REQUIRE(std::equal(output, output + 64, ciphertext));
+    REQUIRE(std::equal(chain, chain + 16, ciphertext + 48));
+    std::copy(iv, iv + 16, chain);
+    cbc_decrypt(schedule, chain, output, output, 64 / 16);
+    REQUIRE(std::equal(output, output + 64, plaintext));
+    REQUIRE(std::equal(chain, chain + 16, ciphertext + 48));
+
+    // the updated iv continues the stream in the next call
+    std::copy(iv, iv + 16, chain);
+    cbc_encrypt(schedule, chain, plaintext, output, 1);
+    cbc_encrypt(schedule, chain, plaintext + 16, output + 16, 3);
+    REQUIRE(std::equal(output, output + 64, ciphertext));
+    std::copy(iv, iv + 16, chain);
+    cbc_decrypt(schedule, chain, output, output, 3);
+    cbc_decrypt(schedule, chain, output + 48, output + 48, 1);
+    REQUIRE(std::equal(output, output + 64, plaintext));
+
+    // longer than a batch, and on the pool over several chunks, in place and not
+    const size_t nblocks = PARALLEL_MIN_BLOCKS + CBC_BATCH_BLOCKS + 3;
+    std::vector<uint8_t> text(16 * nblocks), encrypted(16 * nblocks), decrypted(16 * nblocks);
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        text[i] = static_cast<uint8_t>(i * 7 + (i >> 10));
+    }
+    std::copy(iv, iv + 16, chain);
+    cbc_encrypt(schedule, chain, text.data(), encrypted.data(), nblocks);
+    ThreadPool pool(3);
+    uint8_t parallel_chain[16];
+    std::copy(iv, iv + 16, parallel_chain);
+    cbc_decrypt_parallel(schedule, parallel_chain, encrypted.data(), decrypted.data(), nblocks, pool);
+    REQUIRE(decrypted == text);
+    REQUIRE(std::equal(parallel_chain, parallel_chain + 16, chain));
+    std::copy(iv, iv + 16, parallel_chain);
+    cbc_decrypt_parallel(schedule, parallel_chain, encrypted.data(), encrypted.data(), nblocks, pool);
+    REQUIRE(encrypted == text);
+    REQUIRE(std::equal(parallel_chain, parallel_chain + 16, chain));
+
+    // streams of different lengths, more than there are lanes, each the same as on its own
+    const size_t lengths[] = {4, 0, 1, 17, 3, 3, 0, 40, 2, 9, 1, 25};
+    const size_t count = sizeof(lengths) / sizeof(lengths[0]);
+    std::vector<CbcStream> streams(count);
+    std::vector<std::vector<uint8_t>> outputs(count);
+    size_t start = 0;
+    for (size_t s = 0; s < count; s++)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            streams[s].iv[i] = static_cast<uint8_t>(iv[i] + s);
+        }
+        outputs[s].resize(16 * lengths[s]);
+        streams[s].in = text.data() + 16 * start;
+        streams[s].out = outputs[s].data();
+        streams[s].nblocks = lengths[s];
+        start += lengths[s];
+    }
+    cbc_encrypt_streams(schedule, streams.data(), count);
+    start = 0;
+    for (size_t s = 0; s < count; s++)
+    {
+        INFO("stream " << s);
+        std::vector<uint8_t> expected(16 * lengths[s]);
+        for (int i = 0; i < 16; i++)
+        {
+            chain[i] = static_cast<uint8_t>(iv[i] + s);
+        }
+        cbc_encrypt(schedule, chain, text.data() + 16 * start, expected.data(), lengths[s]);
+        REQUIRE(outputs[s] == expected);
+        REQUIRE(std::equal(chain, chain + 16, streams[s].iv));
+        start += lengths[s];
+    }
+}
+
+TEST_CASE("GCM")
+{
+    // NIST GCM test cases 1 to 4 (McGrew and Viega's specification), AES-128
+    uint8_t const zero[16] = {};
+    uint8_t tag[16], output[64];
+    {
+        const Schedule schedule(zero);
+        const Gcm gcm(schedule);
+        uint8_t const expected_tag[16] = {0x58, 0xe2, 0xfc, 0xce, 0xfa, 0x7e, 0x30, 0x61, 0x36, 0x7f, 0x1d, 0x57, 0xa4, 0xe7, 0x45, 0x5a};
+        gcm.encrypt(zero, 12, nullptr, 0, nullptr, nullptr, 0, tag);
+        REQUIRE(std::equal(tag, tag + 16, expected_tag));
+        uint8_t const ciphertext[16] = {0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92, 0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78};
+        uint8_t const expected_tag_2[16] = {0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd, 0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf};
+        gcm.encrypt(zero, 12, nullptr, 0, zero, output, 16, tag);
+        REQUIRE(std::equal(output, output + 16, ciphertext));
+        REQUIRE(std::equal(tag, tag + 16, expected_tag_2));
+    }
+    uint8_t const key[16] = {0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08};
+    uint8_t const iv[12] = {0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88};
+    uint8_t const aad[20] = {0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+                             0xab, 0xad, 0xda, 0xd2};
+    uint8_t const plaintext[64] = {0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+                                   0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda, 0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+                                   0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+                                   0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39, 0x1a, 0xaf, 0xd2, 0x55};
+    uint8_t const ciphertext[64] = {0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24, 0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c,
+                                    0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0, 0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e,
+                                    0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c, 0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+                                    0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97, 0x3d, 0x58, 0xe0, 0x91, 0x47, 0x3f, 0x59, 0x85};
+    uint8_t const tag_3[16] = {0x4d, 0x5c, 0x2a, 0xf3, 0x27, 0xcd, 0x64, 0xa6, 0x2c, 0xf3, 0x5a, 0xbd, 0x2b, 0xa6, 0xfa, 0xb4};
+    uint8_t const tag_4[16] = {0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb, 0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47};
+    uint8_t const tag_5[16] = {0x36, 0x12, 0xd2, 0xe7, 0x9e, 0x3b, 0x07, 0x85, 0x56, 0x1b, 0xe1, 0x4a, 0xac, 0xa2, 0xfc, 0xcb};
+    const Schedule schedule(key);
+    const Gcm gcm(schedule);
+    gcm.encrypt(iv, 12, nullptr, 0, plaintext, output, 64, tag);
+    REQUIRE(std::equal(output, output + 64, ciphertext));
+    REQUIRE(std::equal(tag, tag + 16, tag_3));
+    REQUIRE(gcm.decrypt(iv, 12, nullptr, 0, output, output, 64, tag));
+    REQUIRE(std::equal(output, output + 64, plaintext));
+
+    // with additional data and a partial last block, and a 64-bit iv that is hashed into J0 (test case 5)
+    gcm.encrypt(iv, 12, aad, 20, plaintext, output, 60, tag);
+    REQUIRE(std::equal(output, output + 60, ciphertext));
+    REQUIRE(std::equal(tag, tag + 16, tag_4));
+    gcm.encrypt(iv, 8, aad, 20, plaintext, output, 60, tag);
+    REQUIRE(std::equal(tag, tag + 16, tag_5));
+    REQUIRE(gcm.decrypt(iv, 8, aad, 20, output, output, 60, tag));
+    REQUIRE(std::equal(output, output + 60, plaintext));
+
+    // a changed tag, ciphertext or additional data fails and leaves no plaintext
+    gcm.encrypt(iv, 12, aad, 20, plaintext, output, 60, tag);
+    tag[15] ^= 1;
+    REQUIRE(!gcm.decrypt(iv, 12, aad, 20, output, output, 60, tag));
+    REQUIRE(std::all_of(output, output + 60, [](uint8_t byte) { return byte == 0; }));
+    tag[15] ^= 1;
+    std::copy(ciphertext, ciphertext + 60, output);
+    output[7] ^= 0x80;
+    REQUIRE(!gcm.decrypt(iv, 12, aad, 20, output, output, 60, tag));
+    std::copy(ciphertext, ciphertext + 60, output);
+    REQUIRE(!gcm.decrypt(iv, 12, aad, 19, output, output, 60, tag));
+
+    // above 2^32 - 2 blocks inc32 would wrap into the counter block of the tag, nothing is read or written
+    REQUIRE(!gcm.encrypt(iv, 12, nullptr, 0, nullptr, nullptr, GCM_MAX_LENGTH + 1, tag));
+    REQUIRE(!gcm.decrypt(iv, 12, nullptr, 0, nullptr, nullptr, GCM_MAX_LENGTH + 1, tag));
+
+    // the aggregated GHASH is Horner's rule with ghash_multiply
+    std::vector<uint8_t> text(16 * 300 + 9);
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        text[i] = static_cast<uint8_t>(i * 7 + (i >> 10));
+    }
+    uint8_t h[16];
+    schedule.encrypt_blocks(zero, h, 1);
+    for (size_t size : {0, 16, 5 * 16, 8 * 16, 9 * 16 + 3, 300 * 16 + 9})
+    {
+        INFO("size " << size);
+        uint8_t y[16] = {1, 2, 3}, expected[16] = {1, 2, 3};
+        gcm.ghash(y, text.data(), size);
+        for (size_t i = 0; i < size; i += 16)
+        {
+            for (size_t b = 0; b < 16 && i + b < size; b++)
+            {
+                expected[b] ^= text[i + b];
+            }
+            ghash_multiply(expected, h, expected);
+        }
+        REQUIRE(std::equal(y, y + 16, expected));
+    }
+
+    // the stitched loop and the keystream batches of every backend agree, for every key size, across
+    // whole groups and batches
+    uint8_t const cipher_key[32] = {0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+                                    0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4};
+    uint8_t const other_iv[12] = {0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xff, 0xff, 0xff, 0xfb};
+    uint8_t const *ivs[] = {iv, other_iv};
+    const size_t lengths[] = {1, 127, 128, 129, 1000, 16 * GCM_BATCH_BLOCKS + 16 * 8 + 5};
+    for (size_t key_size : KEY_SIZES)
+    {
+        const Schedule reference_schedule(cipher_key, key_size, *FindBackend("ttable"));
+        const Gcm reference(reference_schedule);
+        for (size_t b = 0; b < BACKEND_COUNT; b++)
+        {
+            if (!BACKENDS[b].supported())
+            {
+                continue;
+            }
+            const Schedule backend_schedule(cipher_key, key_size, BACKENDS[b]);
+            const Gcm backend_gcm(backend_schedule);
+            for (uint8_t const *nonce : ivs)
+            {
+                for (size_t length : lengths)
+                {
+                    INFO(BACKENDS[b].name << " key size " << key_size << " length " << length);
+                    std::vector<uint8_t> expected(length), encrypted(length);
+                    uint8_t expected_tag[16];
+                    reference.encrypt(nonce, 12, aad, 20, text.data(), expected.data(), length, expected_tag);
+                    backend_gcm.encrypt(nonce, 12, aad, 20, text.data(), encrypted.data(), length, tag);
+                    REQUIRE(encrypted == expected);
+                    REQUIRE(std::equal(tag, tag + 16, expected_tag));
+                    REQUIRE(backend_gcm.decrypt(nonce, 12, aad, 20, encrypted.data(), encrypted.data(), length, tag));
+                    REQUIRE(std::equal(encrypted.begin(), encrypted.end(), text.begin()));
+                }
+            }
+        }
+    }
+
+    // a 12 byte iv always starts the counter at 2, so the wrap of inc32 is checked on the counter
+    // itself and on the stitched loop started just below it
+    uint8_t counter[16] = {0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0x00, 0x00, 0x00, 0x07, 0xff, 0xff, 0xff, 0xfd};
+    uint8_t expected_counter[16];
+    std::copy(counter, counter + 16, expected_counter);
+    for (int i = 0; i < 3; i++)
+    {
+        gcm_increment(expected_counter);
+    }
+    REQUIRE(expected_counter[11] == 0x07);
+    REQUIRE(std::all_of(expected_counter + 12, expected_counter + 16, [](uint8_t byte) { return byte == 0; }));
+    if (cpu_has_aesni() && cpu_has_pclmul())
+    {
+        const size_t nblocks = 2 * GCM_AGGREGATE;
+        std::vector<uint8_t> counters(16 * nblocks), expected(16 * nblocks), encrypted(16 * nblocks);
+        uint8_t expected_y[16] = {}, y[16] = {}, powers[16 * GCM_AGGREGATE];
+        std::copy(counter, counter + 16, expected_counter);
+        for (size_t b = 0; b < nblocks; b++)
+        {
+            std::copy(expected_counter, expected_counter + 16, counters.begin() + 16 * b);
+            gcm_increment(expected_counter);
+        }
+        schedule.encrypt_blocks(counters.data(), expected.data(), nblocks);
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            expected[i] ^= text[i];
+        }
+        for (size_t b = 0; b < nblocks; b++)
+        {
+            xor_keystream(expected.data() + 16 * b, expected_y, expected_y, 16);
+            ghash_multiply(expected_y, h, expected_y);
+        }
+        clmul_powers(h, powers);
+        uint8_t start[16];
+        std::copy(counter, counter + 16, start);
+        EncryptGroups_GCM<4>(schedule.round_keys(), powers, counter, y, text.data(), encrypted.data(), 2);
+        REQUIRE(encrypted == expected);
+        REQUIRE(std::equal(y, y + 16, expected_y));
+        REQUIRE(std::equal(counter, counter + 16, expected_counter));
+        std::fill(y, y + 16, 0);
+        DecryptGroups_GCM<4>(schedule.round_keys(), powers, start, y, encrypted.data(), encrypted.data(), 2);
+        REQUIRE(std::equal(encrypted.begin(), encrypted.end(), text.begin()));
+        REQUIRE(std::equal(y, y + 16, expected_y));
+    }
+}
+
+TEST_CASE("multiply_in_GF_GFNI256")
+{
+    if (!cpu_has_gfni_avx2())
+    {
+        return;
+    }
+    // every pair of bytes, one row of b at a time
+    uint8_t a[256], b[256], product[256];
+    for (int x = 0; x < 256; x++)
+    {
+        a[x] = static_cast<uint8_t>(x);
+    }
+    for (int y = 0; y < 256; y++)
+    {
+        for (int x = 0; x < 256; x++)
+        {
+            b[x] = static_cast<uint8_t>(y);
+        }
+        // an odd length also exercises the scalar tail
+        multiply_in_GF_GFNI256(a, b, product, 255);
+        for (int x = 0; x < 255; x++)
+        {
+            REQUIRE(multiply_in_GF(a[x], b[x]) == product[x]);
+        }
+    }
+}
+
+TEST_CASE("Zero allocations")
+{
+    static uint8_t input[1024 * 16], output[1024 * 16];
+    // the first call picks the backend
+    SelectBackend();
+
+    for (size_t b = 0; b < BACKEND_COUNT; b++)
+    {
+        Backend const &backend = BACKENDS[b];
+        if (!backend.supported())
+        {
+            continue;
+        }
+        INFO("backend " << backend.name);
+
+        size_t before = allocations;
+        {
+            const Schedule schedule(fips_key, backend);
+            encrypt_blocks(schedule, input, output, 1024);
+            encrypt_blocks(schedule, input, output, 7);
+        }
+        size_t after = allocations;
+        REQUIRE(after == before);
+    }
+
+    size_t before = allocations;
+    {
+        const Schedule schedule(fips_key);
+        encrypt_blocks(schedule, input, output, 1024);
+        Cipher(schedule.round_keys(), input, output);
+    }
+    size_t after = allocations;
+    REQUIRE(after == before);
+}
+
+TEST_CASE("ThreadPool")
+{
+    // more threads than this machine may have cores, so chunks get stolen
+    ThreadPool pool(3);
+    REQUIRE(pool.size() == 4);
+
+    // every index runs exactly once
+    std::vector<std::atomic<int>> calls(1000);
+    for (int job = 0; job < 10; job++)
+    {
+        pool.parallel_for(calls.size(), [&](size_t i) { calls[i]++; });
+    }
+    for (std::atomic<int> const &count : calls)
+    {
+        REQUIRE(count == 10);
+    }
+
+    const Schedule schedule(fips_key);
+    // a little over the threshold, with a partial last chunk
+    const size_t nblocks = PARALLEL_MIN_BLOCKS + PARALLEL_CHUNK_BLOCKS / 2 + 3;
+    std::vector<uint8_t> input(16 * nblocks), expected(16 * nblocks), output(16 * nblocks);
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        input[i] = static_cast<uint8_t>(i * 31 + (i >> 12));
+    }
+    encrypt_blocks(schedule, input.data(), expected.data(), nblocks);
+    for (size_t n : {nblocks, PARALLEL_MIN_BLOCKS - 1, static_cast<size_t>(5)})
+    {
+        std::fill(output.begin(), output.end(), 0);
+        encrypt_blocks_parallel(schedule, input.data(), output.data(), n, pool);
+        REQUIRE(std::equal(expected.begin(), expected.begin() + 16 * n, output.begin()));
+    }
+}
+
+TEST_CASE("Schedule")
+{
+    REQUIRE(alignof(Schedule) == 64);
+
+    // threads with different keys at the same time, each checked against the reference Cipher
+    const int thread_count = 4;
+    const size_t nblocks = 2000;
+    bool matches[thread_count] = {};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++)
+    {
+        threads.emplace_back([t, &matches]() {
+            uint8_t cipher_key[16];
+            for (int i = 0; i < 16; i++)
+            {
+                cipher_key[i] = static_cast<uint8_t>(t * 16 + i);
+            }
+            const Schedule schedule(cipher_key);
+            std::vector<uint8_t> input(16 * nblocks), output(16 * nblocks);
+            for (size_t i = 0; i < input.size(); i++)
+            {
+                input[i] = static_cast<uint8_t>(i + t);
+            }
+            bool all = true;
+            for (int repeat = 0; repeat < 20; repeat++)
+            {
+                encrypt_blocks(schedule, input.data(), output.data(), nblocks);
+                for (size_t b = 0; b < nblocks; b += 97)
+                {
+                    uint8_t expected[16];
+                    Cipher(schedule.round_keys(), &input[16 * b], expected);
+                    all = all && std::equal(expected, expected + 16, &output[16 * b]);
+                }
+            }
+            matches[t] = all;
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    for (int t = 0; t < thread_count; t++)
+    {
+        REQUIRE(matches[t]);
+    }
+}
+
+// The plaintext of the file tests, different in every byte of a block
+static std::vector<uint8_t> test_plaintext(size_t size)
+{
+    std::vector<uint8_t> plaintext(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        plaintext[i] = static_cast<uint8_t>(i * 3 + (i >> 8));
+    }
+    return plaintext;
+}
+
+// The plaintext padded with zero bytes to whole blocks and encrypted
+static std::vector<uint8_t> padded_ciphertext(Schedule const &schedule, std::vector<uint8_t> const &plaintext)
+{
+    std::vector<uint8_t> ciphertext((plaintext.size() + 15) / 16 * 16, 0);
+    std::copy(plaintext.begin(), plaintext.end(), ciphertext.begin());
+    encrypt_blocks_in_place(schedule, ciphertext.data(), ciphertext.size() / 16);
+    return ciphertext;
+}
+
+static void write_file(char const *path, std::vector<uint8_t> const &bytes)
+{
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<char const *>(bytes.data()), bytes.size());
+}
+
+// The input of encrypt_file: the key, then the plaintext
+static std::vector<uint8_t> write_input(char const *path, std::vector<uint8_t> const &plaintext)
+{
+    std::vector<uint8_t> input(KEY_SIZE + plaintext.size());
+    std::copy(fips_key, fips_key + KEY_SIZE, input.begin());
+    std::copy(plaintext.begin(), plaintext.end(), input.begin() + KEY_SIZE);
+    write_file(path, input);
+    return input;
+}
+
+static std::vector<uint8_t> read_file(char const *path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("encrypt_stream")
+{
+    const Schedule schedule(fips_key);
+
+    for (size_t size : {static_cast<size_t>(0), static_cast<size_t>(15), static_cast<size_t>(16),
+                        STREAM_CHUNK_SIZE, 2 * STREAM_CHUNK_SIZE + 21})
+    {
+        INFO("size " << size);
+        std::vector<uint8_t> plaintext = test_plaintext(size);
+        std::vector<uint8_t> expected = padded_ciphertext(schedule, plaintext);
+
+        std::istringstream in(std::string(plaintext.begin(), plaintext.end()));
+        std::FILE *file = std::tmpfile();
+        {
+            Output out(fileno(file));
+            REQUIRE(encrypt_stream(schedule, in, out) == size);
+            REQUIRE(out.flush());
+        }
+        std::vector<uint8_t> ciphertext(expected.size() + 1);
+        std::rewind(file);
+        ciphertext.resize(std::fread(ciphertext.data(), 1, ciphertext.size(), file));
+        std::fclose(file);
+        REQUIRE(ciphertext == expected);
+    }
+}
+
+TEST_CASE("encrypt_file")
+{
+    const Schedule schedule(fips_key);
+    char in_path[] = "/tmp/aes_test_in_XXXXXX";
+    char out_path[] = "/tmp/aes_test_out_XXXXXX";
+    close(mkstemp(in_path));
+    close(mkstemp(out_path));
+
+    for (size_t size : {static_cast<size_t>(0), static_cast<size_t>(33), PARALLEL_MIN_BLOCKS * 16 + 48})
+    {
+        INFO("size " << size);
+        std::vector<uint8_t> plaintext = test_plaintext(size);
+        write_input(in_path, plaintext);
+        REQUIRE(encrypt_file(in_path, out_path));
+        REQUIRE(read_file(out_path) == padded_ciphertext(schedule, plaintext));
+    }
+
+    // the input as the output, by name or through a link, is refused and left as it was
+    std::vector<uint8_t> before = read_file(in_path);
+    std::string link_path = std::string(out_path) + ".link";
+    REQUIRE(symlink(in_path, link_path.c_str()) == 0);
+    REQUIRE_FALSE(encrypt_file(in_path, in_path));
+    REQUIRE_FALSE(encrypt_file(in_path, link_path.c_str()));
+    REQUIRE_FALSE(ctr_file(in_path, link_path.c_str(), fips_key, 0));
+    REQUIRE(read_file(in_path) == before);
+    unlink(link_path.c_str());
+
+    // a file shorter than a key
+    std::ofstream(in_path, std::ios::binary).write("short", 5);
+    REQUIRE_FALSE(encrypt_file(in_path, out_path));
+
+    unlink(in_path);
+    unlink(out_path);
+}
+
+TEST_CASE("encrypt_file_uring")
+{
+    const Schedule schedule(fips_key);
+    char in_path[] = "/tmp/aes_test_uring_in_XXXXXX";
+    char out_path[] = "/tmp/aes_test_uring_out_XXXXXX";
+    close(mkstemp(in_path));
+    close(mkstemp(out_path));
+
+    // more chunks than buffers, so the buffers are reused
+    for (size_t size : {static_cast<size_t>(0), static_cast<size_t>(33), 2 * URING_DEPTH * URING_CHUNK_SIZE + 45})
+    {
+        INFO("size " << size);
+        std::vector<uint8_t> plaintext = test_plaintext(size);
+        write_input(in_path, plaintext);
+        REQUIRE(encrypt_file_uring(in_path, out_path));
+        REQUIRE(read_file(out_path) == padded_ciphertext(schedule, plaintext));
+    }
+
+    // a file shorter than a key
+    std::ofstream(in_path, std::ios::binary).write("short", 5);
+    REQUIRE_FALSE(encrypt_file_uring(in_path, out_path));
+
+    unlink(in_path);
+    unlink(out_path);
+}
+
+TEST_CASE("encrypt_file_in_place")
+{
+    const Schedule schedule(fips_key);
+    char path[] = "/tmp/aes_test_in_place_XXXXXX";
+    close(mkstemp(path));
+
+    for (size_t size : {static_cast<size_t>(0), static_cast<size_t>(37), PARALLEL_MIN_BLOCKS * 16 + 32})
+    {
+        INFO("size " << size);
+        std::vector<uint8_t> plaintext = test_plaintext(size);
+        write_input(path, plaintext);
+
+        // the key, then the ciphertext of the zero padded plaintext
+        std::vector<uint8_t> ciphertext = padded_ciphertext(schedule, plaintext);
+        std::vector<uint8_t> expected(KEY_SIZE + ciphertext.size());
+        std::copy(fips_key, fips_key + KEY_SIZE, expected.begin());
+        std::copy(ciphertext.begin(), ciphertext.end(), expected.begin() + KEY_SIZE);
+
+        REQUIRE(encrypt_file_in_place(path));
+        REQUIRE(read_file(path) == expected);
+    }
+    unlink(path);
+}
+
+TEST_CASE("decrypt_file")
+{
+    char in_path[] = "/tmp/aes_test_in_XXXXXX";
+    char out_path[] = "/tmp/aes_test_out_XXXXXX";
+    close(mkstemp(in_path));
+    close(mkstemp(out_path));
+
+    for (size_t size : {static_cast<size_t>(0), static_cast<size_t>(37), PARALLEL_MIN_BLOCKS * 16 + 32})
+    {
+        INFO("size " << size);
+        std::vector<uint8_t> plaintext = test_plaintext(size);
+        std::vector<uint8_t> input = write_input(in_path, plaintext);
+        // decryption gives back the plaintext padded with zero bytes
+        plaintext.resize((size + 15) / 16 * 16, 0);
+        input.resize(KEY_SIZE + plaintext.size(), 0);
+
+        // encrypted in place and decrypted into another file, then back in place
+        REQUIRE(encrypt_file_in_place(in_path));
+        REQUIRE(decrypt_file(in_path, out_path));
+        REQUIRE(read_file(out_path) == plaintext);
+
+        REQUIRE(decrypt_file_in_place(in_path));
+        REQUIRE(read_file(in_path) == input);
+    }
+
+    // a ciphertext that is not whole blocks
+    std::ofstream(in_path, std::ios::binary).write("0123456789abcdef0123", 20);
+    REQUIRE_FALSE(decrypt_file(in_path, out_path));
+    REQUIRE_FALSE(decrypt_file_in_place(in_path));
+
+    unlink(in_path);
+    unlink(out_path);
+}
+
+TEST_CASE("Rings")
+{
+    SpscRing<size_t> spsc(4);
+    size_t value;
+    REQUIRE_FALSE(spsc.try_pop(value));
+    for (size_t i = 0; i < 4; i++)
+    {
+        REQUIRE(spsc.try_push(i));
+    }
+    REQUIRE_FALSE(spsc.try_push(4));
+    REQUIRE(spsc.try_pop(value));
+    REQUIRE(value == 0);
+
+    // three producers, every value arrives exactly once and each producer's values in order
+    MpscRing<size_t> mpsc(8);
+    const size_t per_producer = 100000;
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < 3; p++)
+    {
+        producers.emplace_back([&mpsc, p, per_producer]() {
+            for (size_t i = 0; i < per_producer; i++)
+            {
+                while (!mpsc.try_push(p * per_producer + i))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    size_t next[3] = {0, 0, 0};
+    bool in_order = true;
+    for (size_t received = 0; received < 3 * per_producer;)
+    {
+        if (!mpsc.try_pop(value))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        size_t p = value / per_producer;
+        in_order = in_order && value % per_producer == next[p]++;
+        received++;
+    }
+    for (std::thread &producer : producers)
+    {
+        producer.join();
+    }
+    REQUIRE(in_order);
+    REQUIRE_FALSE(mpsc.try_pop(value));
+}
+
+TEST_CASE("encrypt_pipeline")
+{
+    const Schedule schedule(fips_key);
+    char in_path[] = "/tmp/aes_test_pipeline_in_XXXXXX";
+    char out_path[] = "/tmp/aes_test_pipeline_out_XXXXXX";
+    close(mkstemp(in_path));
+    close(mkstemp(out_path));
+
+    // more chunks than the pipeline has, so they are recycled
+    for (size_t size : {static_cast<size_t>(0), static_cast<size_t>(15), Pipeline::CHUNK_SIZE, 11 * Pipeline::CHUNK_SIZE + 21})
+    {
+        std::vector<uint8_t> plaintext = test_plaintext(size);
+        write_file(in_path, plaintext);
+        std::vector<uint8_t> expected = padded_ciphertext(schedule, plaintext);
+        // 64 is more than MAX_WORKERS, the pipeline uses fewer
+        for (unsigned workers : {1u, 3u, 64u})
+        {
+            INFO("size " << size << ", " << workers << " workers");
+            int in_fd = open(in_path, O_RDONLY);
+            int out_fd = open(out_path, O_WRONLY | O_TRUNC);
+            REQUIRE(encrypt_pipeline(schedule, in_fd, out_fd, workers));
+            close(in_fd);
+            close(out_fd);
+            REQUIRE(read_file(out_path) == expected);
+        }
+    }
+    unlink(in_path);
+    unlink(out_path);
+}
+
+TEST_CASE("encrypt_stream_to_pipe")
+{
+    const Schedule schedule(fips_key);
+    char in_path[] = "/tmp/aes_test_splice_in_XXXXXX";
+    close(mkstemp(in_path));
+    int file_fd = open(in_path, O_RDONLY);
+    REQUIRE_FALSE(is_pipe(file_fd));
+    close(file_fd);
+
+    // several times the buffers, so they are reused while the reader is still behind
+    for (size_t size : {static_cast<size_t>(0), static_cast<size_t>(17), 5 * static_cast<size_t>(SPLICE_PIPE_SIZE) + 3})
+    {
+        INFO("size " << size);
+        std::vector<uint8_t> plaintext = test_plaintext(size);
+        write_file(in_path, plaintext);
+        std::vector<uint8_t> expected = padded_ciphertext(schedule, plaintext);
+
+        int pipe_fds[2];
+        REQUIRE(pipe(pipe_fds) == 0);
+        REQUIRE(is_pipe(pipe_fds[1]));
+        // a slow reader, a page at a time with a pause after each, so the writer has to wait for it
+        std::vector<uint8_t> output;
+        std::thread reader([&]() {
+            uint8_t buffer[4096];
+            ssize_t got;
+            while ((got = read(pipe_fds[0], buffer, sizeof(buffer))) > 0)
+            {
+                output.insert(output.end(), buffer, buffer + got);
+                std::this_thread::sleep_for(std::chrono::microseconds(20));
+            }
+        });
+        int in_fd = open(in_path, O_RDONLY);
+        bool ok = encrypt_stream_to_pipe(schedule, in_fd, pipe_fds[1]);
+        close(in_fd);
+        close(pipe_fds[1]);
+        reader.join();
+        close(pipe_fds[0]);
+        REQUIRE(ok);
+        REQUIRE(output == expected);
+    }
+    unlink(in_path);
+}